@@ -0,0 +1,266 @@
+/**
+ * @file
+ *
+ * Compares the generic elist against the typed flist generated by
+ * ELIST_DEFINE / ELIST_DEFINE_SORT on the entry type da sorts: appending,
+ * reading back, and sorting with da's own comparators (traverse.h) called
+ * through qsort() versus inlined.
+ *
+ * Usage: ./bench/elist_bench [entries]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "elist.h"
+#include "elist_typed.h"
+#include "traverse.h"
+
+/**
+ * Number of entries used when none is given on the command line.
+ */
+#define BENCH_DEFAULT_N 1000000
+
+/**
+ * Each timing is the best of this many repetitions.
+ */
+#define BENCH_REPEAT 3
+
+/**
+* @brief		qsort-style wrapper around cmp_size().
+* @details	    qsort-style wrapper around cmp_size(), for elist_sort().
+* @param[in]	a First argument.
+* @param[in]    b Second argument.
+* @return       The result of cmp_size().
+*/
+static int cmpsf(const void *a, const void *b)
+{
+    return cmp_size(a, b);
+}
+
+/**
+* @brief		qsort-style wrapper around cmp_path().
+* @details	    qsort-style wrapper around cmp_path(), for elist_sort().
+* @param[in]	a First argument.
+* @param[in]    b Second argument.
+* @return       The result of cmp_path().
+*/
+static int cmppf(const void *a, const void *b)
+{
+    return cmp_path(a, b);
+}
+
+ELIST_DEFINE_SORT(flist, struct f, by_size, cmp_size)
+ELIST_DEFINE_SORT(flist, struct f, by_path, cmp_path)
+
+/**
+* Orders of input the sorts are measured on.
+*/
+enum pattern {
+    PATTERN_RANDOM,     /*!< Random sizes */
+    PATTERN_SORTED,     /*!< Already in the final order */
+    PATTERN_REVERSED,   /*!< In the opposite order */
+    PATTERN_FEW,        /*!< Only a few distinct sizes, so ties hit strcmp */
+    PATTERN_PATHS,      /*!< Shuffled paths, sorted by path as extsort
+                             spills snapshot runs */
+};
+
+static const char *pattern_names[] = { "random", "sorted", "reversed", "few",
+    "paths" };
+
+/**
+* @brief		Get a monotonic time in milliseconds.
+* @details	    Get a monotonic time in milliseconds.
+* @return	    The time.
+*/
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+* @brief		Fill an array of entries in one of the input orders.
+* @details	    Fill an array of entries in one of the input orders. Paths are
+*               shared with the caller's path table, not copied.
+* @param[out]	entries The entries to fill.
+* @param[in]	paths One path per entry.
+* @param[in]	n Number of entries.
+* @param[in]	pattern The input order.
+* @return	    None.
+*/
+static void fill(struct f *entries, char **paths, size_t n,
+        enum pattern pattern)
+{
+    srand(42);
+    for (size_t i = 0; i < n; i++) {
+        entries[i].path = paths[i];
+        entries[i].accTime = i;
+        switch (pattern) {
+            case PATTERN_RANDOM:
+                entries[i].size = ((unsigned long) rand() << 16) ^ rand();
+                break;
+            case PATTERN_SORTED:
+                entries[i].size = n - i;
+                break;
+            case PATTERN_REVERSED:
+                entries[i].size = i;
+                break;
+            case PATTERN_FEW:
+            case PATTERN_PATHS:
+                entries[i].size = rand() % 16;
+                break;
+        }
+    }
+    if (pattern == PATTERN_PATHS) {
+        for (size_t i = n - 1; i > 0; i--) {
+            size_t j = (((size_t) rand() << 16) ^ rand()) % (i + 1);
+            char *temp = entries[i].path;
+            entries[i].path = entries[j].path;
+            entries[j].path = temp;
+        }
+    }
+}
+
+/**
+* @brief		Print one row of results.
+* @details	    Print the elist and flist times of one operation and the
+*               speedup of the typed list.
+* @param[in]	name The operation.
+* @param[in]	generic Time taken by elist (ms).
+* @param[in]	typed Time taken by flist (ms).
+* @return	    None.
+*/
+static void report(const char *name, double generic, double typed)
+{
+    printf("%-16s %10.1f ms %10.1f ms %8.2fx\n", name, generic, typed,
+            typed > 0 ? generic / typed : 0);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_N;
+    if (n == 0) {
+        fprintf(stderr, "Usage: %s [entries]\n", argv[0]);
+        return 1;
+    }
+
+    char **paths = malloc(n * sizeof(char *));
+    struct f *entries = malloc(n * sizeof(struct f));
+    if (paths == NULL || entries == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/bench/dir%03zu/file%09zu", i % 997, i);
+        paths[i] = strdup(path);
+    }
+
+    printf("%zu entries, best of %d\n\n", n, BENCH_REPEAT);
+    printf("%-16s %13s %13s %9s\n", "operation", "elist", "flist", "speedup");
+
+    /* Appending and reading back do not depend on the input order. */
+    fill(entries, paths, n, PATTERN_RANDOM);
+    double add_generic = 0, add_typed = 0, get_generic = 0, get_typed = 0;
+    unsigned long sum_generic = 0, sum_typed = 0;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = now_ms();
+        struct elist *list = elist_create(0, sizeof(struct f));
+        for (size_t i = 0; i < n; i++) {
+            elist_add(list, &entries[i]);
+        }
+        double mid = now_ms();
+        sum_generic = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum_generic += ((struct f *) elist_get(list, i))->size;
+        }
+        double end = now_ms();
+        elist_destroy(list);
+        if (r == 0 || mid - start < add_generic) {
+            add_generic = mid - start;
+        }
+        if (r == 0 || end - mid < get_generic) {
+            get_generic = end - mid;
+        }
+
+        start = now_ms();
+        struct flist *typed = flist_create(0);
+        for (size_t i = 0; i < n; i++) {
+            flist_add(typed, &entries[i]);
+        }
+        mid = now_ms();
+        sum_typed = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum_typed += flist_get(typed, i)->size;
+        }
+        end = now_ms();
+        flist_destroy(typed);
+        if (r == 0 || mid - start < add_typed) {
+            add_typed = mid - start;
+        }
+        if (r == 0 || end - mid < get_typed) {
+            get_typed = end - mid;
+        }
+    }
+    if (sum_generic != sum_typed) {
+        fprintf(stderr, "Lists disagree on contents\n");
+        return 1;
+    }
+    report("add", add_generic, add_typed);
+    report("get", get_generic, get_typed);
+
+    for (int p = PATTERN_RANDOM; p <= PATTERN_PATHS; p++) {
+        int (*cmp)(const void *, const void *)
+            = p == PATTERN_PATHS ? cmppf : cmpsf;
+        double sort_generic = 0, sort_typed = 0;
+        for (int r = 0; r < BENCH_REPEAT; r++) {
+            fill(entries, paths, n, p);
+            struct elist *list = elist_create(n, sizeof(struct f));
+            struct flist *typed = flist_create(n);
+            for (size_t i = 0; i < n; i++) {
+                elist_add(list, &entries[i]);
+                flist_add(typed, &entries[i]);
+            }
+
+            double start = now_ms();
+            elist_sort(list, cmp);
+            double mid = now_ms();
+            if (p == PATTERN_PATHS) {
+                flist_sort_by_path(typed);
+            } else {
+                flist_sort_by_size(typed);
+            }
+            double end = now_ms();
+
+            for (size_t i = 0; i < n; i++) {
+                if (cmp(elist_get(list, i), flist_get(typed, i)) != 0) {
+                    fprintf(stderr, "Sorts disagree at %zu (%s)\n", i,
+                            pattern_names[p]);
+                    return 1;
+                }
+            }
+            elist_destroy(list);
+            flist_destroy(typed);
+            if (r == 0 || mid - start < sort_generic) {
+                sort_generic = mid - start;
+            }
+            if (r == 0 || end - mid < sort_typed) {
+                sort_typed = end - mid;
+            }
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "sort (%s)", pattern_names[p]);
+        report(name, sort_generic, sort_typed);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    free(entries);
+    return 0;
+}
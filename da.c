@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <getopt.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,7 +9,11 @@
 #include <time.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
 #include "elist.h"
+#include "extsort.h"
+#include "snapshot.h"
+#include "traverse.h"
 #include "util.h"
 
 #include "logger.h"
@@ -18,6 +23,24 @@
 */
 #define __MAX = 256
 
+/**
+* Number of entries shown in each list of a diff when -l is not given.
+*/
+#define DEFAULT_DIFF_LIMIT 10
+
+/**
+* Share (1/N) of --mem-limit given to the traversal's queue of directories
+* waiting to be scanned; the sorter gets the rest.
+*/
+#define QUEUE_MEM_SHARE 8
+
+/**
+* Memory budget for snapshot and diff scans when -m is not given. They are
+* sorted by path through the external sorter, so they never need the whole
+* tree in memory.
+*/
+#define DEFAULT_SNAPSHOT_MEM (256 * 1024 * 1024)
+
 /* Forward declarations: */
 
 /**
@@ -29,75 +52,107 @@
 void print_usage(char *argv[]);
 
 /**
-* The struct of the element in elist about documents.
+* @brief		qsort-style wrapper around cmp_time().
+* @details	    qsort-style wrapper around cmp_time(), for extsort's merge.
+* @param[in]	a First argument.
+* @param[in]    b Second argument.
+* @return       The result of cmp_time().
 */
-struct f{
-    unsigned long size;
-    char* path;
-    time_t accTime;
-};
-
+int cmptf(const void *a, const void *b) {
+    return cmp_time(a, b);
+}
 
 /**
-* @brief		To traverse a path and write into a elist.
-* @details	    To traverse a path and write into a elist recursively.
-* @param[in]	list The elist we want to write into.
-* @param[in]    path The path we want to traverse.
-* @return       None.
+* @brief		qsort-style wrapper around cmp_size().
+* @details	    qsort-style wrapper around cmp_size(), for extsort's merge.
+* @param[in]	a First argument.
+* @param[in]    b Second argument.
+* @return       The result of cmp_size().
 */
-void tDir(struct elist* list, char* path) {
-
-    DIR *dir = NULL;
-    struct dirent *currentDir = NULL;
+int cmpsf(const void *a, const void *b) {
+    return cmp_size(a, b);
+}
 
-    char p[256];
+/**
+* @brief		qsort-style wrapper around cmp_path().
+* @details	    qsort-style wrapper around cmp_path(), for extsort's merge.
+* @param[in]	a First argument.
+* @param[in]    b Second argument.
+* @return       The result of cmp_path().
+*/
+int cmppf(const void *a, const void *b) {
+    return cmp_path(a, b);
+}
 
-    dir = opendir(path);
+/**
+* Sorts of the typed entry list with cmp_time/cmp_size/cmp_path inlined, used
+* in place of elist_sort() with cmptf/cmpsf/cmppf, both on the in-memory path
+* and for the runs extsort spills.
+*/
+ELIST_DEFINE_SORT(flist, struct f, by_time, cmp_time)
+ELIST_DEFINE_SORT(flist, struct f, by_size, cmp_size)
+ELIST_DEFINE_SORT(flist, struct f, by_path, cmp_path)
 
-    // loop
-    while ( (currentDir = readdir(dir)) != NULL) {
-        // remove read finish
-        if ( (!strncmp(currentDir->d_name, ".", 1)) || (!strncmp(currentDir->d_name, "..", 2)) ) {
-            continue;
-        }
-        snprintf(p, sizeof(p) - 1, "%s/%s", path, currentDir->d_name);
-        struct stat info;
-        stat(p, &info);
-        time_t tempT = info.st_atimespec.tv_sec;
-        struct f temp = {info.st_size, p, tempT};
-        if (S_ISDIR(info.st_mode)) {
-            tDir(list, p);
-        } else {
-            elist_add(list, &temp);
-        }
-    }
-    closedir(dir);
+/**
+* @brief		Traversal sink that appends entries to a flist.
+* @details	    Traversal sink that appends entries to a flist.
+* @param[in]	entry The entry found.
+* @param[in]    list The flist to append to.
+* @return       If success return 0, else return -1.
+*/
+int collect(struct f *entry, void *list) {
+    return flist_add(list, entry) == -1 ? -1 : 0;
 }
 
 /**
-* @brief		The comparator function to sort with last accessed time.
-* @details	    The comparator function to sort with last accessed time.
-* @param[in]	a First argument.
-* @param[in]    b Second argument.
-* @return       If b is after a, return -1, if b and a is equivalent, return 0, else return 1.
+* @brief		Scan a directory into a snapshot ordered by path.
+* @details	    Scan a directory into a snapshot ordered by path, spilling to
+*               disk past mem_limit.
+* @param[in]	directory The directory to scan.
+* @param[in]    opts Traversal options.
+* @param[in]    mem_limit Memory budget in bytes, including opts->queue_mem.
+* @return       The snapshot, or NULL on error.
 */
-int cmptf(const void *a, const void *b) {
-    struct f* sa = (struct f*) a;
-    struct f* sb = (struct f*) b;
-    return sb->accTime - sa->accTime;
+struct snapshot *scan_snapshot(char *directory, struct traverse_options *opts,
+        size_t mem_limit) {
+    struct extsort *sorter
+        = extsort_create(mem_limit - opts->queue_mem, cmppf,
+                flist_sort_by_path);
+    if (sorter == NULL) {
+        return NULL;
+    }
+    if (traverse(directory, opts, extsort_add, sorter) == -1
+            || extsort_finish(sorter) == -1) {
+        extsort_destroy(sorter);
+        return NULL;
+    }
+    struct snapshot *snap = snapshot_from_sorter(sorter, directory);
+    if (snap == NULL) {
+        extsort_destroy(sorter);
+    }
+    return snap;
 }
 
 /**
-* @brief		The comparator function to sort with last accessed size.
-* @details	    The comparator function to sort with last accessed size.
-* @param[in]	a First argument.
-* @param[in]    b Second argument.
-* @return       If b is after a, return -1, if b and a is equivalent, return 0, else return 1.
+* @brief		Print one entry as a line of the report.
+* @details	    Print one entry as a line of the report.
+* @param[in]	temp The entry to print.
+* @param[in]    widPath Width of the path column.
+* @return       None.
 */
-int cmpsf(const void *a, const void *b) {
-    struct f* sa = (struct f*) a;
-    struct f* sb = (struct f*) b;
-    return sb->size - sa->size;
+void print_entry(struct f *temp, int widPath) {
+    char p[widPath + 1];
+    size_t len = strlen(temp->path);
+    if (len > widPath) {
+        snprintf(p, sizeof(p), "...%s", temp->path + len - widPath + 3);
+    } else {
+        snprintf(p, sizeof(p), "%*s", widPath, temp->path);
+    }
+    char s[15];
+    human_readable_size(s, sizeof(s), (double) temp->size, 1);
+    char at[16];
+    simple_time_format(at, sizeof(at), temp->accTime);
+    fprintf(stderr, "%s%s%s\n", p, s, at);
 }
 
 /**
@@ -108,15 +163,33 @@ int cmpsf(const void *a, const void *b) {
 */
 void print_usage(char *argv[]) {
 fprintf(stderr, "Disk Analyzer (da): analyzes disk space usage\n");
-fprintf(stderr, "Usage: %s [-ahs] [-l limit] [directory]\n\n", argv[0]);
+fprintf(stderr, "Usage: %s [-ahsxHLP] [-j jobs] [-l limit] [-m size] [-o snapshot] [directory]\n", argv[0]);
+fprintf(stderr, "       %s -d old-snapshot [options] [new-snapshot | directory]\n\n", argv[0]);
 
 fprintf(stderr, "If no directory is specified, the current working directory is used.\n\n");
 
 fprintf(stderr, "Options:\n"
 "    * -a              Sort the files by time of last access (descending)\n"
+"    * -d, --diff old-snapshot\n"
+"                      Report what changed since old-snapshot: the top N\n"
+"                      files and directories by growth, new and deleted files\n"
+"                      (N set by -l, default=10)\n"
 "    * -h              Display help/usage information\n"
+"    * -j jobs         Worker threads per device (default=1)\n"
 "    * -l limit        Limit the output to top N files (default=unlimited)\n"
-"    * -s              Sort the files by size (default, ascending)\n\n"
+"    * -m, --mem-limit size\n"
+"                      Keep at most size bytes (K/M/G suffixes allowed) of\n"
+"                      entries in memory, sorting the rest on disk (at least\n"
+"                      1M; default=unlimited, or 256M with -o and -d)\n"
+"    * -o, --snapshot file\n"
+"                      Save the scan to a snapshot file instead of printing it\n"
+"    * -s              Sort the files by size (default, ascending)\n"
+"    * -x, --one-file-system\n"
+"                      Do not descend into other file systems\n"
+"    * -H              Follow a symbolic link given as the directory only\n"
+"                      (default)\n"
+"    * -L              Follow all symbolic links\n"
+"    * -P              Never follow symbolic links, not even the directory\n\n"
 );
 }
 
@@ -126,27 +199,82 @@ int main(int argc, char *argv[])
      * 'options' variable. Defaults:
      *      - sort by size (time=false)
      *      - limit of 0 (unlimited)
-     *      - directory = '.' (current directory) */
+     *      - directory = '.' (current directory)
+     *      - cross file systems, follow only a symlinked directory argument,
+     *        one thread per device
+     *      - no memory limit (0)
+     *      - no snapshot to save or diff against */
     struct da_options {
         bool sort_by_time;
         unsigned int limit;
         char *directory;
+        struct traverse_options traversal;
+        size_t mem_limit;
+        char *snapshot;
+        char *diff;
     } options
-        = { false, 0, "." };
+        = { false, 0, ".", { false, SYMLINKS_ROOT, 1, 0, 0 }, 0, NULL, NULL };
+
+    static struct option long_options[] = {
+        { "one-file-system", no_argument, NULL, 'x' },
+        { "mem-limit", required_argument, NULL, 'm' },
+        { "snapshot", required_argument, NULL, 'o' },
+        { "diff", required_argument, NULL, 'd' },
+        { NULL, 0, NULL, 0 },
+    };
 
     int c;
     opterr = 0;
-    while ((c = getopt(argc, argv, "ahl:s")) != -1) {
+    while ((c = getopt_long(argc, argv, "ad:hj:l:m:o:sxHLP", long_options, NULL))
+            != -1) {
         switch (c) {
             case 'a':
                 options.sort_by_time = true;
                 break;
+            case 'd':
+                options.diff = optarg;
+                break;
             case 'h':
                 print_usage(argv);
                 return 0;
+            case 'o':
+                options.snapshot = optarg;
+                break;
             case 's':
                 options.sort_by_time = false;
                 break;
+            case 'x':
+                options.traversal.one_file_system = true;
+                break;
+            case 'H':
+                options.traversal.symlinks = SYMLINKS_ROOT;
+                break;
+            case 'L':
+                options.traversal.symlinks = SYMLINKS_ALWAYS;
+                break;
+            case 'P':
+                options.traversal.symlinks = SYMLINKS_NEVER;
+                break;
+            case 'j': {
+                char *endptr;
+                long ljobs = strtol(optarg, &endptr, 10);
+                if (ljobs < 1 || ljobs > 256 || endptr == optarg) {
+                    fprintf(stderr, "Invalid job count: %s\n", optarg);
+                    print_usage(argv);
+                    return 1;
+                }
+                options.traversal.jobs = (unsigned int) ljobs;
+                break;
+                }
+            case 'm':
+                if (parse_size(optarg, &options.mem_limit) == -1
+                        || options.mem_limit < EXTSORT_MIN_MEM) {
+                    fprintf(stderr, "Invalid memory limit: %s (minimum %dK)\n",
+                            optarg, EXTSORT_MIN_MEM / 1024);
+                    print_usage(argv);
+                    return 1;
+                }
+                break;
             case 'l': {
                 /*    ^-- to declare 'endptr' here we need to enclose this case
                  *    in its own scope with curly braces { } */
@@ -161,7 +289,8 @@ int main(int argc, char *argv[])
                 break;
                 }
             case '?':
-                if (optopt == 'l') {
+                if (optopt == 'l' || optopt == 'j' || optopt == 'm'
+                        || optopt == 'o' || optopt == 'd') {
                     fprintf(stderr,
                             "Option -%c requires an argument.\n", optopt);
                 } else if (isprint(optopt)) {
@@ -181,11 +310,81 @@ int main(int argc, char *argv[])
         options.directory = argv[optind];
     }
 
+    if (options.mem_limit == 0
+            && (options.snapshot != NULL || options.diff != NULL)) {
+        options.mem_limit = DEFAULT_SNAPSHOT_MEM;
+    }
+    if (options.mem_limit != 0) {
+        /* Hand entries over one at a time so worker batches do not hold
+         * memory outside the sorter's budget, and charge queued directories
+         * to the budget too. */
+        options.traversal.batch = 1;
+        options.traversal.queue_mem = options.mem_limit / QUEUE_MEM_SHARE;
+    }
+
     LOGP("Done parsing arguments.\n");
     LOG("Sorting by: [%s], limit: [%u]\n",
             options.sort_by_time == true ? "time" : "size",
             options.limit);
     LOG("Directory to analyze: [%s]\n", options.directory);
+    LOG("One file system: [%d], symlinks: [%d], jobs per device: [%u]\n",
+            options.traversal.one_file_system, options.traversal.symlinks,
+            options.traversal.jobs);
+    LOG("Memory limit: [%zu]\n", options.mem_limit);
+
+    struct stat root_info;
+    if (options.traversal.symlinks == SYMLINKS_NEVER
+            && lstat(options.directory, &root_info) == 0
+            && S_ISLNK(root_info.st_mode)
+            && stat(options.directory, &root_info) == 0
+            && S_ISDIR(root_info.st_mode)) {
+        printf("Error: %s is a symbolic link; use -H or -L to follow it.\n",
+                options.directory);
+        return 1;
+    }
+
+    if (options.diff != NULL) {
+        /* The new side is either another snapshot or a live scan. */
+        struct stat info;
+        struct snapshot *old = snapshot_open(options.diff);
+        struct snapshot *new;
+        if (stat(options.directory, &info) == 0 && S_ISREG(info.st_mode)) {
+            new = snapshot_open(options.directory);
+        } else {
+            new = scan_snapshot(options.directory, &options.traversal,
+                    options.mem_limit);
+        }
+        if (old == NULL || new == NULL) {
+            printf("Error: Could not read snapshot or scan directory.\n");
+            if (old != NULL) {
+                snapshot_close(old);
+            }
+            if (new != NULL) {
+                snapshot_close(new);
+            }
+            return 1;
+        }
+        int rc = snapshot_diff(old, new,
+                options.limit == 0 ? DEFAULT_DIFF_LIMIT : options.limit);
+        snapshot_close(old);
+        snapshot_close(new);
+        if (rc == -1) {
+            printf("Error: Could not compare snapshots.\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    if (options.snapshot != NULL) {
+        struct snapshot *snap = scan_snapshot(options.directory,
+                &options.traversal, options.mem_limit);
+        if (snap == NULL || snapshot_save(snap, options.snapshot) == -1) {
+            printf("Error: Could not write snapshot.\n");
+            return 1;
+        }
+        snapshot_close(snap);
+        return 0;
+    }
 
     /* TODO:
      *  - check to ensure the directory actually exists
@@ -199,36 +398,67 @@ int main(int argc, char *argv[])
         printf("Error: No such file or path.");
         return 0;
     } else {
-        struct elist* list = elist_create(10, sizeof(struct f));
-        tDir(list, options.directory);
+        closedir(dir);
+        int (*comparator)(const void *, const void *)
+            = options.sort_by_time ? cmptf : cmpsf;
         unsigned short cols = 80;
         struct winsize win_sz;
         if (ioctl(fileno(stdout), TIOCGWINSZ, &win_sz) != -1) {
             cols = win_sz.ws_col;
         }
         LOG("Display columns: %d\n", cols);
-        if (options.sort_by_time) {
-            elist_sort(list,cmptf);
-        } else {
-            elist_sort(list,cmpsf);
-        }
         int widPath = 80 - 29;
-        for (int i = 0; i < options.limit; i++) {
-            struct f* temp = (struct f*) elist_get(list, i);
-            char *p = (char*) malloc (widPath + 1);
-            if (strlen(temp->path) > widPath) {
-                snprintf(p, widPath, "...%s", strlen(temp->path) - widPath + 4 + temp->path);
+
+        if (options.mem_limit == 0) {
+            struct flist *list = flist_create(0);
+            if (list == NULL || traverse(options.directory,
+                        &options.traversal, collect, list) == -1) {
+                printf("Error: Could not scan the whole directory.\n");
+                if (list != NULL) {
+                    for (size_t i = 0; i < flist_size(list); i++) {
+                        free(list->items[i].path);
+                    }
+                    flist_destroy(list);
+                }
+                return 1;
+            }
+            if (options.sort_by_time) {
+                flist_sort_by_time(list);
             } else {
-                for (int j = 0; j < widPath - strlen(temp->path); j++) {
-                    snprintf(p + j, 1, " ");
+                flist_sort_by_size(list);
+            }
+            for (int i = 0; i < options.limit && i < flist_size(list); i++) {
+                print_entry(flist_get(list, i), widPath);
+            }
+            for (size_t i = 0; i < flist_size(list); i++) {
+                free(list->items[i].path);
+            }
+            flist_destroy(list);
+        } else {
+            /* Bounded-memory path: runs are spilled to disk during the scan
+             * and merged back in the same order the in-memory sort gives. */
+            struct extsort *sorter
+                = extsort_create(options.mem_limit
+                        - options.traversal.queue_mem, comparator,
+                        options.sort_by_time
+                        ? flist_sort_by_time : flist_sort_by_size);
+            if (sorter == NULL
+                    || traverse(options.directory, &options.traversal,
+                        extsort_add, sorter) == -1
+                    || extsort_finish(sorter) == -1) {
+                printf("Error: Could not sort entries within memory limit.");
+                if (sorter != NULL) {
+                    extsort_destroy(sorter);
                 }
-                snprintf(p + widPath - strlen(temp->path), strlen(temp->path), "%s",temp->path);
+                return 1;
+            }
+            struct f temp;
+            for (int i = 0; i < options.limit
+                    && extsort_next(sorter, &temp) == 1; i++) {
+                print_entry(&temp, widPath);
+                free(temp.path);
             }
-            char *s = (char*) malloc (15);
-            human_readable_size(s, 14, (double) temp->size, 1);
-            char *at = (char*) malloc (16);
-            simple_time_format(at, 15, temp->accTime);
-            fprintf(stderr, "%s%s%s", p, s, at);
+            extsort_destroy(sorter);
         }
     }
     return 0;
@@ -90,7 +90,9 @@ int elist_set_capacity(struct elist *list, size_t capacity)
     list->element_storage = (void*) realloc (list->element_storage, capacity * list->item_sz);
     if (capacity < list->capacity) {
         list->capacity = capacity;
-        list->size = capacity;
+        if (list->size > capacity) {
+            list->size = capacity;
+        }
         return 0;
     } else {
         list->capacity = capacity;
@@ -227,7 +229,7 @@ int elist_remove(struct elist *list, size_t idx)
         } else {
             memmove(list->element_storage + list->item_sz * idx,
                     list->element_storage + list->item_sz * (idx + 1),
-                    (list->size - idx) * list->item_sz);
+                    (list->size - idx - 1) * list->item_sz);
             list->size--;
             return 0;
         }
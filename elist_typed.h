@@ -0,0 +1,241 @@
+/**
+ * @file
+ *
+ * Type-specialized elists. ELIST_DEFINE(name, type) generates a list of one
+ * concrete element type with the same operations as struct elist, but with
+ * fixed-size element copies the compiler can inline, and
+ * ELIST_DEFINE_SORT(name, type, suffix, cmp) generates a sort with the
+ * comparator inlined instead of called through qsort().
+ *
+ * Example Usage:
+ * ELIST_DEFINE(flist, struct f)
+ * ELIST_DEFINE_SORT(flist, struct f, by_size, cmp_size)
+ *
+ * struct flist *list = flist_create(0);
+ * flist_add(list, &entry);
+ * flist_sort_by_size(list);
+ */
+
+#ifndef _ELIST_TYPED_H_
+#define _ELIST_TYPED_H_
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+/**
+ * Default init size of a typed elist.
+ */
+#define ELIST_TYPED_INIT_SZ 10
+
+/**
+ * Times multiplied when a typed elist is extended.
+ */
+#define ELIST_TYPED_RESIZE_MULTIPLIER 2
+
+/**
+ * Partitions smaller than this are finished with insertion sort.
+ */
+#define ELIST_TYPED_SORT_CUTOFF 16
+
+/**
+ * Defines struct name holding items of type, and its operations:
+ * name_create, name_destroy, name_set_capacity, name_add, name_add_new,
+ * name_get, name_size and name_clear. Return values follow the matching
+ * elist_* functions.
+ */
+#define ELIST_DEFINE(name, type) \
+    struct name { \
+        size_t capacity; \
+        size_t size; \
+        type *items; \
+    }; \
+    \
+    static inline struct name *name##_create(size_t list_sz) \
+    { \
+        if (list_sz == 0) { \
+            list_sz = ELIST_TYPED_INIT_SZ; \
+        } \
+        struct name *list = calloc(1, sizeof(struct name)); \
+        if (list == NULL) { \
+            return NULL; \
+        } \
+        list->capacity = list_sz; \
+        list->items = malloc(list_sz * sizeof(type)); \
+        if (list->items == NULL) { \
+            free(list); \
+            return NULL; \
+        } \
+        return list; \
+    } \
+    \
+    static inline void name##_destroy(struct name *list) \
+    { \
+        free(list->items); \
+        free(list); \
+    } \
+    \
+    static inline int name##_set_capacity(struct name *list, size_t capacity) \
+    { \
+        type *items = realloc(list->items, capacity * sizeof(type)); \
+        if (items == NULL && capacity > 0) { \
+            return -1; \
+        } \
+        list->items = items; \
+        list->capacity = capacity; \
+        if (list->size > capacity) { \
+            list->size = capacity; \
+        } \
+        return 0; \
+    } \
+    \
+    static inline type *name##_add_new(struct name *list) \
+    { \
+        if (list->size == list->capacity \
+                && name##_set_capacity(list, \
+                    ELIST_TYPED_RESIZE_MULTIPLIER * list->capacity + 1) \
+                == -1) { \
+            return NULL; \
+        } \
+        return &list->items[list->size++]; \
+    } \
+    \
+    static inline ssize_t name##_add(struct name *list, const type *item) \
+    { \
+        type *slot = name##_add_new(list); \
+        if (slot == NULL) { \
+            return -1; \
+        } \
+        *slot = *item; \
+        return 0; \
+    } \
+    \
+    static inline type *name##_get(struct name *list, size_t idx) \
+    { \
+        return idx < list->size ? &list->items[idx] : NULL; \
+    } \
+    \
+    static inline size_t name##_size(struct name *list) \
+    { \
+        return list->size; \
+    } \
+    \
+    static inline void name##_clear(struct name *list) \
+    { \
+        list->size = 0; \
+    }
+
+/**
+ * Defines name_sort_suffix(struct name *list), which sorts the list with
+ * cmp(const type *, const type *) inlined. It is an introsort: quicksort
+ * with median-of-three pivots, heapsort once recursion gets too deep, and
+ * insertion sort for small partitions. Like qsort(), it is not stable.
+ */
+#define ELIST_DEFINE_SORT(name, type, suffix, cmp) \
+    static inline void name##_isort_##suffix(type *items, size_t n) \
+    { \
+        for (size_t i = 1; i < n; i++) { \
+            type temp = items[i]; \
+            size_t j = i; \
+            while (j > 0 && cmp(&temp, &items[j - 1]) < 0) { \
+                items[j] = items[j - 1]; \
+                j--; \
+            } \
+            items[j] = temp; \
+        } \
+    } \
+    \
+    static inline void name##_sift_##suffix(type *items, size_t root, \
+            size_t n) \
+    { \
+        type temp = items[root]; \
+        size_t child; \
+        while ((child = 2 * root + 1) < n) { \
+            if (child + 1 < n && cmp(&items[child], &items[child + 1]) < 0) { \
+                child++; \
+            } \
+            if (cmp(&temp, &items[child]) >= 0) { \
+                break; \
+            } \
+            items[root] = items[child]; \
+            root = child; \
+        } \
+        items[root] = temp; \
+    } \
+    \
+    static inline void name##_hsort_##suffix(type *items, size_t n) \
+    { \
+        for (size_t i = n / 2; i > 0; i--) { \
+            name##_sift_##suffix(items, i - 1, n); \
+        } \
+        for (size_t i = n - 1; i > 0; i--) { \
+            type temp = items[0]; \
+            items[0] = items[i]; \
+            items[i] = temp; \
+            name##_sift_##suffix(items, 0, i); \
+        } \
+    } \
+    \
+    static inline void name##_qsort_##suffix(type *items, size_t n, \
+            int depth) \
+    { \
+        while (n > ELIST_TYPED_SORT_CUTOFF) { \
+            if (depth-- == 0) { \
+                name##_hsort_##suffix(items, n); \
+                return; \
+            } \
+            \
+            type temp; \
+            size_t mid = n / 2; \
+            if (cmp(&items[mid], &items[0]) < 0) { \
+                temp = items[mid]; items[mid] = items[0]; items[0] = temp; \
+            } \
+            if (cmp(&items[n - 1], &items[mid]) < 0) { \
+                temp = items[n - 1]; items[n - 1] = items[mid]; \
+                items[mid] = temp; \
+                if (cmp(&items[mid], &items[0]) < 0) { \
+                    temp = items[mid]; items[mid] = items[0]; \
+                    items[0] = temp; \
+                } \
+            } \
+            type pivot = items[mid]; \
+            \
+            size_t i = 0, j = n - 1; \
+            while (1) { \
+                while (cmp(&items[i], &pivot) < 0) { \
+                    i++; \
+                } \
+                while (cmp(&pivot, &items[j]) < 0) { \
+                    j--; \
+                } \
+                if (i >= j) { \
+                    break; \
+                } \
+                temp = items[i]; items[i] = items[j]; items[j] = temp; \
+                i++; \
+                j--; \
+            } \
+            \
+            /* Recurse into the smaller half so the stack stays shallow. */ \
+            size_t left = j + 1; \
+            if (left < n - left) { \
+                name##_qsort_##suffix(items, left, depth); \
+                items += left; \
+                n -= left; \
+            } else { \
+                name##_qsort_##suffix(items + left, n - left, depth); \
+                n = left; \
+            } \
+        } \
+        name##_isort_##suffix(items, n); \
+    } \
+    \
+    static inline void name##_sort_##suffix(struct name *list) \
+    { \
+        int depth = 0; \
+        for (size_t n = list->size; n > 1; n >>= 1) { \
+            depth += 2; \
+        } \
+        name##_qsort_##suffix(list->items, list->size, depth); \
+    }
+
+#endif
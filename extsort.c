@@ -0,0 +1,557 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "elist.h"
+#include "extsort.h"
+#include "logger.h"
+
+/**
+* stdio buffer size for each run file being read or written.
+*/
+#define RUN_BUF_SZ (64 * 1024)
+
+/**
+* File descriptors left for the traversal and stdio when capping the fan-in.
+*/
+#define FD_RESERVE 32
+
+/**
+* A sorted run file on disk. Runs are only open while being written or merged.
+*/
+struct run {
+    size_t id;              /*!< Names the file run-<id> in the sorter's dir */
+};
+
+/**
+* A sorted run file being read during a merge, along with its current entry.
+*/
+struct run_cursor {
+    FILE *file;
+    struct f cur;
+};
+
+/**
+* A k-way merge over sorted run files, kept as a binary min-heap on the
+* current entry of each run.
+*/
+struct merge {
+    struct run_cursor *heap;
+    size_t size;
+    FILE **files;           /*!< Every run opened, including exhausted ones */
+    size_t count;
+    int (*comparator)(const void *, const void *);
+};
+
+/**
+* Collects entries within a memory budget, spilling sorted runs to temporary
+* files when the budget is exceeded, and hands them back in sorted order.
+* Half the budget holds in-memory entries and half the buffers of a merge.
+*/
+struct extsort {
+    size_t mem_limit;       /*!< Budget for everything the sorter holds */
+    size_t path_bytes;      /*!< Bytes used by paths of in-memory entries */
+    size_t next_idx;        /*!< Next in-memory entry to return */
+    size_t fan_in;          /*!< Most runs merged at once */
+    size_t next_run;        /*!< Id of the next run file */
+    char *dir;              /*!< Private directory holding the run files */
+    struct flist *list;     /*!< In-memory entries */
+    struct elist *runs;     /*!< Spilled sorted runs (struct run) */
+    struct merge merge;     /*!< Final merge, once runs exist */
+    int (*comparator)(const void *, const void *);
+    void (*sort)(struct flist *list);   /*!< Typed sort in comparator order */
+};
+
+/**
+* @brief		Estimate the heap footprint of a path.
+* @details	    Estimate what malloc really uses for a path string, including
+*               its chunk header and rounding, not just strlen() + 1.
+* @param[in]	path The path.
+* @return	    The estimated number of bytes.
+*/
+static size_t path_cost(const char *path)
+{
+    size_t cost = (strlen(path) + 1 + sizeof(size_t) + 15) & ~(size_t) 15;
+    return cost < 32 ? 32 : cost;
+}
+
+/**
+* @brief		Work out how many runs may be merged at once.
+* @details	    Work out how many runs fit in the merge half of the budget,
+*               counting each run's stdio buffer, cursor and longest path plus
+*               the output run's buffer, and capped so the open runs leave
+*               file descriptors for the traversal.
+* @param[in]	mem_limit The sorter's budget in bytes.
+* @return	    The fan-in, at least 2.
+*/
+static size_t max_fan_in(size_t mem_limit)
+{
+    size_t budget = mem_limit / 2;
+    size_t per_run = RUN_BUF_SZ + PATH_MAX + sizeof(struct run_cursor)
+        + sizeof(FILE *);
+    size_t fan_in = budget > RUN_BUF_SZ ? (budget - RUN_BUF_SZ) / per_run : 0;
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0
+            && limit.rlim_cur != RLIM_INFINITY) {
+        size_t fds = limit.rlim_cur > FD_RESERVE
+            ? limit.rlim_cur - FD_RESERVE : 0;
+        if (fan_in > fds) {
+            fan_in = fds;
+        }
+    }
+    return fan_in < 2 ? 2 : fan_in;
+}
+
+/**
+* @brief		Open a run file.
+* @details	    Open a run file in the sorter's directory, creating the
+*               directory in $TMPDIR (or /tmp) the first time.
+* @param[in]	sorter The sorter.
+* @param[in]	run The run.
+* @param[in]	mode "w" to write the run, "r" to read it back.
+* @return	    The file, or NULL on error.
+*/
+static FILE *open_run(struct extsort *sorter, struct run *run,
+        const char *mode)
+{
+    char path[PATH_MAX];
+    if (sorter->dir == NULL) {
+        char *tmp = getenv("TMPDIR");
+        snprintf(path, sizeof(path), "%s/da-sort-XXXXXX",
+                tmp != NULL ? tmp : "/tmp");
+        if (mkdtemp(path) == NULL || (sorter->dir = strdup(path)) == NULL) {
+            LOGL(LOG_LEVEL_ERROR, "Could not create directory for runs\n");
+            return NULL;
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/run-%zu", sorter->dir, run->id);
+    FILE *file = fopen(path, mode);
+    if (file == NULL) {
+        LOGL(LOG_LEVEL_ERROR, "Could not open run file: %s\n", path);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, RUN_BUF_SZ);
+    return file;
+}
+
+/**
+* @brief		Delete a run file.
+* @details	    Delete a run file once it has been merged or is not needed.
+* @param[in]	sorter The sorter.
+* @param[in]	run The run.
+* @return	    None.
+*/
+static void remove_run(struct extsort *sorter, struct run *run)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/run-%zu", sorter->dir, run->id);
+    unlink(path);
+}
+
+/**
+* @brief		Write one entry to a run file.
+* @details	    Write one entry to a run (or snapshot) file as size, access
+*               time, path length and path bytes.
+* @param[in]	file The run file.
+* @param[in]	entry The entry to write.
+* @return	    If success return 0, else return -1.
+*/
+int extsort_write_entry(FILE *file, struct f *entry)
+{
+    uint32_t len = strlen(entry->path);
+    if (fwrite(&entry->size, sizeof(entry->size), 1, file) != 1
+            || fwrite(&entry->accTime, sizeof(entry->accTime), 1, file) != 1
+            || fwrite(&len, sizeof(len), 1, file) != 1
+            || fwrite(entry->path, 1, len, file) != len) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* @brief		Read one entry from a run file.
+* @details	    Read one entry from a run file. The path is heap allocated.
+* @param[in]	file The run file.
+* @param[out]	entry The entry read.
+* @return	    1 if an entry was read, 0 at end of file, -1 on error.
+*/
+int extsort_read_entry(FILE *file, struct f *entry)
+{
+    uint32_t len;
+    if (fread(&entry->size, sizeof(entry->size), 1, file) != 1) {
+        return feof(file) ? 0 : -1;
+    }
+    if (fread(&entry->accTime, sizeof(entry->accTime), 1, file) != 1
+            || fread(&len, sizeof(len), 1, file) != 1) {
+        return -1;
+    }
+    entry->path = malloc(len + 1);
+    if (entry->path == NULL || fread(entry->path, 1, len, file) != len) {
+        free(entry->path);
+        return -1;
+    }
+    entry->path[len] = '\0';
+    return 1;
+}
+
+/**
+* @brief		Restore the heap property below a slot.
+* @details	    Restore the heap property below a slot.
+* @param[in]	merge The merge.
+* @param[in]	idx The slot to sift down from.
+* @return	    None.
+*/
+static void sift_down(struct merge *merge, size_t idx)
+{
+    while (true) {
+        size_t least = idx;
+        size_t left = 2 * idx + 1;
+        size_t right = left + 1;
+        if (left < merge->size && merge->comparator(&merge->heap[left].cur,
+                    &merge->heap[least].cur) < 0) {
+            least = left;
+        }
+        if (right < merge->size && merge->comparator(&merge->heap[right].cur,
+                    &merge->heap[least].cur) < 0) {
+            least = right;
+        }
+        if (least == idx) {
+            return;
+        }
+        struct run_cursor temp = merge->heap[idx];
+        merge->heap[idx] = merge->heap[least];
+        merge->heap[least] = temp;
+        idx = least;
+    }
+}
+
+/**
+* @brief		Start merging a set of runs.
+* @details	    Open each run, read its first entry and build the heap.
+* @param[out]	merge The merge to set up.
+* @param[in]	sorter The sorter the runs belong to.
+* @param[in]	runs The runs.
+* @param[in]	count Number of runs.
+* @return	    If success return 0, else return -1.
+*/
+static int merge_open(struct merge *merge, struct extsort *sorter,
+        struct run *runs, size_t count)
+{
+    merge->heap = calloc(count, sizeof(struct run_cursor));
+    merge->files = calloc(count, sizeof(FILE *));
+    merge->size = 0;
+    merge->count = 0;
+    merge->comparator = sorter->comparator;
+    if (merge->heap == NULL || merge->files == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        FILE *file = open_run(sorter, &runs[i], "r");
+        if (file == NULL) {
+            return -1;
+        }
+        merge->files[merge->count++] = file;
+
+        struct run_cursor *cursor = &merge->heap[merge->size];
+        cursor->file = file;
+        int rc = extsort_read_entry(cursor->file, &cursor->cur);
+        if (rc == -1) {
+            return -1;
+        } else if (rc == 1) {
+            merge->size++;
+        }
+    }
+    for (size_t i = merge->size / 2; i > 0; i--) {
+        sift_down(merge, i - 1);
+    }
+    return 0;
+}
+
+/**
+* @brief		Take the next entry from a merge.
+* @details	    Take the smallest current entry and advance its run. The caller
+*               owns the returned path.
+* @param[in]	merge The merge.
+* @param[out]	entry The next entry.
+* @return	    1 if an entry was returned, 0 when done, -1 on error.
+*/
+static int merge_next(struct merge *merge, struct f *entry)
+{
+    if (merge->size == 0) {
+        return 0;
+    }
+
+    *entry = merge->heap[0].cur;
+    int rc = extsort_read_entry(merge->heap[0].file, &merge->heap[0].cur);
+    if (rc == -1) {
+        return -1;
+    } else if (rc == 0) {
+        merge->heap[0] = merge->heap[--merge->size];
+    }
+    sift_down(merge, 0);
+    return 1;
+}
+
+/**
+* @brief		Release a merge.
+* @details	    Free the current entries still held by a merge and close its
+*               run files.
+* @param[in]	merge The merge.
+* @return	    None.
+*/
+static void merge_close(struct merge *merge)
+{
+    for (size_t i = 0; i < merge->size; i++) {
+        free(merge->heap[i].cur.path);
+    }
+    for (size_t i = 0; i < merge->count; i++) {
+        fclose(merge->files[i]);
+    }
+    free(merge->heap);
+    free(merge->files);
+    merge->heap = NULL;
+    merge->files = NULL;
+    merge->size = 0;
+    merge->count = 0;
+}
+
+/**
+* @brief		Sort the in-memory entries and write them out as a run.
+* @details	    Sort the in-memory entries, write them to a new run file and
+*               free them. The run file is closed until it is merged.
+* @param[in]	sorter The sorter.
+* @return	    If success return 0, else return -1.
+*/
+static int spill(struct extsort *sorter)
+{
+    struct run run = { sorter->next_run++ };
+    FILE *file = open_run(sorter, &run, "w");
+    if (file == NULL) {
+        return -1;
+    }
+
+    int rc = 0;
+    sorter->sort(sorter->list);
+    for (size_t i = 0; i < flist_size(sorter->list); i++) {
+        struct f *entry = flist_get(sorter->list, i);
+        if (rc == 0 && extsort_write_entry(file, entry) == -1) {
+            rc = -1;
+        }
+        free(entry->path);
+    }
+    flist_clear(sorter->list);
+    sorter->path_bytes = 0;
+    if (fclose(file) != 0) {
+        rc = -1;
+    }
+    if (rc == -1 || elist_add(sorter->runs, &run) == -1) {
+        remove_run(sorter, &run);
+        return -1;
+    }
+
+    LOG("Spilled run %zu\n", run.id);
+    return 0;
+}
+
+/**
+* @brief		Merge the first runs into one.
+* @details	    Merge the first count runs into a new run at the end of the
+*               list and delete them.
+* @param[in]	sorter The sorter.
+* @param[in]	count Number of runs to merge.
+* @return	    If success return 0, else return -1.
+*/
+static int merge_runs(struct extsort *sorter, size_t count)
+{
+    struct run out = { sorter->next_run++ };
+    FILE *file = open_run(sorter, &out, "w");
+    if (file == NULL) {
+        return -1;
+    }
+
+    struct merge merge;
+    int rc = merge_open(&merge, sorter, elist_get(sorter->runs, 0), count);
+    if (rc == 0) {
+        struct f entry;
+        while ((rc = merge_next(&merge, &entry)) == 1) {
+            rc = extsort_write_entry(file, &entry);
+            free(entry.path);
+            if (rc == -1) {
+                break;
+            }
+        }
+    }
+    merge_close(&merge);
+    if (fclose(file) != 0) {
+        rc = -1;
+    }
+    if (rc == -1 || elist_add(sorter->runs, &out) == -1) {
+        remove_run(sorter, &out);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        remove_run(sorter, elist_get(sorter->runs, 0));
+        elist_remove(sorter->runs, 0);
+    }
+    LOG("Merged %zu runs, %zu left\n", count, elist_size(sorter->runs));
+    return 0;
+}
+
+/**
+* @brief		Create an external sorter.
+* @details	    Create a sorter that keeps at most about mem_limit bytes of
+*               entries and merge buffers in memory, spilling sorted runs to
+*               disk when needed.
+* @param[in]	mem_limit The memory budget in bytes.
+* @param[in]	comparator The comparator to merge runs with.
+* @param[in]	sort Sorts the in-memory entries in the comparator's order,
+*               typically a sort generated by ELIST_DEFINE_SORT.
+* @return	    The pointer of the sorter, or NULL on error.
+*/
+struct extsort *extsort_create(size_t mem_limit,
+        int (*comparator)(const void *, const void *),
+        void (*sort)(struct flist *list))
+{
+    struct extsort *sorter = calloc(1, sizeof(struct extsort));
+    if (sorter == NULL) {
+        return NULL;
+    }
+    sorter->mem_limit = mem_limit;
+    sorter->fan_in = max_fan_in(mem_limit);
+    sorter->comparator = comparator;
+    sorter->sort = sort;
+    sorter->list = flist_create(0);
+    sorter->runs = elist_create(0, sizeof(struct run));
+    if (sorter->list == NULL || sorter->runs == NULL) {
+        extsort_destroy(sorter);
+        return NULL;
+    }
+    return sorter;
+}
+
+/**
+* @brief		Add an entry to the sorter.
+* @details	    Add an entry to the sorter, which takes ownership of its path.
+*               Spills a run first if the entry would push the in-memory half
+*               of the budget over. Growing the list counts both the old and
+*               the new array, since realloc may hold both at once. Matches
+*               traverse_sink so it can be handed to traverse().
+* @param[in]	entry The entry to add.
+* @param[in]	sorter The sorter.
+* @return	    If success return 0, else return -1.
+*/
+int extsort_add(struct f *entry, void *sorter)
+{
+    struct extsort *s = sorter;
+    size_t budget = s->mem_limit / 2;
+    size_t capacity = s->list->capacity;
+    size_t size = flist_size(s->list);
+    size_t cost = path_cost(entry->path);
+
+    if (size == capacity) {
+        size_t grown = capacity * 3 * sizeof(struct f) + s->path_bytes + cost;
+        if (grown > budget && size > 0) {
+            if (spill(s) == -1) {
+                return -1;
+            }
+        } else {
+            flist_set_capacity(s->list, capacity * 2);
+        }
+    } else if (capacity * sizeof(struct f) + s->path_bytes + cost > budget
+            && size > 0) {
+        if (spill(s) == -1) {
+            return -1;
+        }
+    }
+
+    s->path_bytes += cost;
+    return flist_add(s->list, entry) == -1 ? -1 : 0;
+}
+
+/**
+* @brief		Finish adding entries and prepare to read them back.
+* @details	    Sort what is left in memory. If anything was spilled, the rest
+*               is spilled too, and runs are merged down until few enough
+*               remain to merge at once within the budget.
+* @param[in]	sorter The sorter.
+* @return	    If success return 0, else return -1.
+*/
+int extsort_finish(struct extsort *sorter)
+{
+    if (elist_size(sorter->runs) == 0) {
+        sorter->sort(sorter->list);
+        return 0;
+    }
+
+    if (flist_size(sorter->list) > 0 && spill(sorter) == -1) {
+        return -1;
+    }
+    flist_set_capacity(sorter->list, 1);
+
+    while (elist_size(sorter->runs) > sorter->fan_in) {
+        if (merge_runs(sorter, sorter->fan_in) == -1) {
+            return -1;
+        }
+    }
+
+    return merge_open(&sorter->merge, sorter, elist_get(sorter->runs, 0),
+            elist_size(sorter->runs));
+}
+
+/**
+* @brief		Get the next entry in sorted order.
+* @details	    Get the next entry in sorted order, after extsort_finish(). The
+*               caller owns the returned path.
+* @param[in]	sorter The sorter.
+* @param[out]	entry The next entry.
+* @return	    1 if an entry was returned, 0 when done, -1 on error.
+*/
+int extsort_next(struct extsort *sorter, struct f *entry)
+{
+    if (elist_size(sorter->runs) > 0) {
+        return merge_next(&sorter->merge, entry);
+    }
+    if (sorter->next_idx >= flist_size(sorter->list)) {
+        return 0;
+    }
+    *entry = *flist_get(sorter->list, sorter->next_idx++);
+    return 1;
+}
+
+/**
+* @brief		Destroy the sorter.
+* @details	    Destroy the sorter, deleting its run files and freeing any
+*               entries that were not returned.
+* @param[in]	sorter The sorter.
+* @return	    None.
+*/
+void extsort_destroy(struct extsort *sorter)
+{
+    if (sorter->list != NULL) {
+        for (size_t i = sorter->next_idx; i < flist_size(sorter->list); i++) {
+            free(flist_get(sorter->list, i)->path);
+        }
+        flist_destroy(sorter->list);
+    }
+    if (sorter->runs != NULL) {
+        merge_close(&sorter->merge);
+        for (size_t i = 0; i < elist_size(sorter->runs); i++) {
+            remove_run(sorter, elist_get(sorter->runs, i));
+        }
+        elist_destroy(sorter->runs);
+    }
+    if (sorter->dir != NULL) {
+        rmdir(sorter->dir);
+        free(sorter->dir);
+    }
+    free(sorter);
+}
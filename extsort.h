@@ -0,0 +1,27 @@
+#ifndef _EXTSORT_H_
+#define _EXTSORT_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "traverse.h"
+
+/**
+* Smallest memory budget an external sorter accepts, so that a run holds more
+* than a handful of entries and at least two runs can be merged at once.
+*/
+#define EXTSORT_MIN_MEM (1024 * 1024)
+
+struct extsort;
+
+int extsort_add(struct f *entry, void *sorter);
+struct extsort *extsort_create(size_t mem_limit,
+        int (*comparator)(const void *, const void *),
+        void (*sort)(struct flist *list));
+void extsort_destroy(struct extsort *sorter);
+int extsort_finish(struct extsort *sorter);
+int extsort_next(struct extsort *sorter, struct f *entry);
+int extsort_read_entry(FILE *file, struct f *entry);
+int extsort_write_entry(FILE *file, struct f *entry);
+
+#endif
@@ -0,0 +1,378 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+/**
+* Number of message slots in each thread's ring buffer. Must be a power of 2.
+*/
+#define RING_SLOTS 256
+
+/**
+* Max length of a single formatted message; longer ones are truncated but
+* still end in a newline.
+*/
+#define MSG_SZ 512
+
+/**
+* Size of the buffer each drain pass formats records into, so a pass costs one
+* write() however many records it holds.
+*/
+#define DRAIN_BUF_SZ (64 * 1024)
+
+/**
+* How long the writer thread sleeps when there is nothing to write (ns).
+*/
+#define WRITER_IDLE_NS 5000000
+
+/**
+* A formatted log message waiting to be written.
+*/
+struct log_record {
+    int level;              /*!< Level the message was logged at */
+    int line;               /*!< Source line of the log statement */
+    const char *file;       /*!< Source file of the log statement */
+    const char *func;       /*!< Function containing the log statement */
+    char msg[MSG_SZ];       /*!< The formatted message text */
+};
+
+/**
+* Single-producer single-consumer ring owned by one logging thread. The owner
+* only advances head and the writer only advances tail, so no lock is needed.
+*/
+struct log_ring {
+    size_t head;                        /*!< Next slot the owner writes */
+    size_t tail;                        /*!< Next slot the writer reads */
+    size_t dropped;                     /*!< Messages lost to a full ring */
+    bool orphaned;                      /*!< Owner thread has exited */
+    struct log_ring *next;              /*!< Next ring in the global list */
+    struct log_record slots[RING_SLOTS];
+};
+
+int logger_level = LOG_LEVEL_DEBUG;
+
+static struct log_ring *rings = NULL;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t writer;
+static bool writer_running = false;
+static bool writer_stop = false;
+static bool use_color = false;
+static char out_buf[DRAIN_BUF_SZ];     /* Guarded by drain_lock */
+static size_t out_len = 0;
+
+static __thread struct log_ring *local_ring = NULL;
+
+static const char *level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+/**
+* @brief		Write out the drain buffer.
+* @details	    Write out the drain buffer with a single fwrite(), so records
+*               do not interleave with other output on stderr.
+* @return	    None.
+*/
+static void out_flush(void)
+{
+    if (out_len > 0) {
+        fwrite(out_buf, 1, out_len, stderr);
+        out_len = 0;
+    }
+}
+
+/**
+* @brief		Format one record into the drain buffer.
+* @details	    Format one record into the drain buffer, tagging anything
+*               above DEBUG with its level. The buffer is written out first if
+*               the record does not fit.
+* @param[in]	rec The record to write.
+* @return	    None.
+*/
+static void emit(struct log_record *rec)
+{
+    char tag[16] = "";
+    if (rec->level > LOG_LEVEL_DEBUG && rec->level < LOG_LEVEL_NONE) {
+        snprintf(tag, sizeof(tag), "[%s] ", level_names[rec->level]);
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t room = DRAIN_BUF_SZ - out_len;
+        int len;
+#if LOGGER_COLOR
+        if (use_color) {
+            len = snprintf(out_buf + out_len, room, "%s%s%s:%d:%s%s()%s: %s%s",
+                    LOGGER_COLOR_RED, rec->file, LOGGER_COLOR_RESET,
+                    rec->line,
+                    LOGGER_COLOR_BLUE, rec->func, LOGGER_COLOR_RESET,
+                    tag, rec->msg);
+        } else
+#endif
+        {
+            len = snprintf(out_buf + out_len, room, "%s:%d:%s(): %s%s",
+                    rec->file, rec->line, rec->func, tag, rec->msg);
+        }
+        if (len >= 0 && (size_t) len < room) {
+            out_len += len;
+            return;
+        }
+        out_flush();
+    }
+
+    /* Only a record longer than the whole buffer gets here; keep what fit. */
+    out_len = DRAIN_BUF_SZ - 1;
+    out_buf[out_len - 1] = '\n';
+}
+
+/**
+* @brief		Write out everything queued in every ring.
+* @details	    Write out everything queued in every ring and free rings whose
+*               owner has exited. Only one thread drains at a time.
+* @return	    The number of records written.
+*/
+static size_t drain(void)
+{
+    size_t count = 0;
+
+    pthread_mutex_lock(&drain_lock);
+    struct log_ring **link = &rings;
+    struct log_ring *ring;
+    while ((ring = __atomic_load_n(link, __ATOMIC_ACQUIRE)) != NULL) {
+        bool orphaned = __atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE);
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t tail = ring->tail;
+        while (tail != head) {
+            emit(&ring->slots[tail & (RING_SLOTS - 1)]);
+            tail++;
+            count++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        size_t dropped = __atomic_exchange_n(&ring->dropped, 0,
+                __ATOMIC_RELAXED);
+        if (dropped > 0) {
+            out_flush();
+            fprintf(stderr, "logger: dropped %zu messages\n", dropped);
+        }
+
+        /* The list head may be swapped concurrently by get_ring(), so an
+         * orphaned ring is only unlinked once newer rings sit in front of
+         * it. */
+        if (orphaned && link != &rings) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    out_flush();
+    pthread_mutex_unlock(&drain_lock);
+
+    return count;
+}
+
+/**
+* @brief		Background thread that writes queued messages.
+* @details	    Background thread that writes queued messages, sleeping briefly
+*               whenever the rings are empty.
+* @param[in]	arg Unused.
+* @return	    NULL.
+*/
+static void *writer_main(void *arg)
+{
+    struct timespec idle = { 0, WRITER_IDLE_NS };
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE)) {
+        if (drain() == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    drain();
+    return NULL;
+}
+
+/**
+* @brief		Mark a thread's ring as orphaned when the thread exits.
+* @details	    Mark a thread's ring as orphaned when the thread exits. The
+*               writer frees it after its remaining messages are written.
+* @param[in]	ring The exiting thread's ring.
+* @return	    None.
+*/
+static void release_ring(void *ring)
+{
+    __atomic_store_n(&((struct log_ring *) ring)->orphaned, true,
+            __ATOMIC_RELEASE);
+}
+
+/**
+* @brief		Stop the writer thread and write any remaining messages.
+* @details	    Stop the writer thread and write any remaining messages.
+*               Registered with atexit() so nothing is lost on normal exit.
+* @return	    None.
+*/
+static void shutdown_writer(void)
+{
+    if (writer_running) {
+        __atomic_store_n(&writer_stop, true, __ATOMIC_RELEASE);
+        pthread_join(writer, NULL);
+        writer_running = false;
+    }
+    drain();
+}
+
+/**
+* @brief		One-time logger setup.
+* @details	    Cache TTY detection, read LOGGER_LEVEL from the environment and
+*               start the writer thread.
+* @return	    None.
+*/
+static void init(void)
+{
+    use_color = LOGGER_COLOR && isatty(STDERR_FILENO);
+
+    char *env = getenv("LOGGER_LEVEL");
+    if (env != NULL) {
+        int level = logger_parse_level(env);
+        if (level >= 0) {
+            logger_set_level(level);
+        }
+    }
+
+    pthread_key_create(&ring_key, release_ring);
+    writer_running = (pthread_create(&writer, NULL, writer_main, NULL) == 0);
+    atexit(shutdown_writer);
+}
+
+/**
+* @brief		Get the calling thread's ring, creating it if needed.
+* @details	    Get the calling thread's ring, creating and registering it on
+*               the thread's first log message.
+* @return	    The ring, or NULL if it could not be allocated.
+*/
+static struct log_ring *get_ring(void)
+{
+    if (local_ring != NULL) {
+        return local_ring;
+    }
+
+    struct log_ring *ring = calloc(1, sizeof(struct log_ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    pthread_setspecific(ring_key, ring);
+
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+
+    local_ring = ring;
+    return ring;
+}
+
+/**
+* @brief		Set the runtime log level.
+* @details	    Set the runtime log level. Messages below it are discarded
+*               before being formatted.
+* @param[in]	level One of the LOG_LEVEL_* values.
+* @return	    None.
+*/
+void logger_set_level(int level)
+{
+    __atomic_store_n(&logger_level, level, __ATOMIC_RELAXED);
+}
+
+/**
+* @brief		Convert a level name to its LOG_LEVEL_* value.
+* @details	    Convert a level name (debug, info, warn, error, none) to its
+*               LOG_LEVEL_* value. Case is ignored.
+* @param[in]	name The level name.
+* @return	    The level, or -1 if the name is not recognized.
+*/
+int logger_parse_level(const char *name)
+{
+    for (int i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            return i;
+        }
+    }
+    if (strcasecmp(name, "none") == 0) {
+        return LOG_LEVEL_NONE;
+    }
+    return -1;
+}
+
+/**
+* @brief		Write out all queued messages now.
+* @details	    Write out all queued messages now, from the calling thread.
+* @return	    None.
+*/
+void logger_flush(void)
+{
+    pthread_once(&init_once, init);
+    drain();
+}
+
+/**
+* @brief		Queue a log message.
+* @details	    Format a log message into the calling thread's ring. If the
+*               ring is full the message is dropped and counted rather than
+*               blocking the caller. Falls back to writing synchronously if the
+*               writer thread could not be started.
+* @param[in]	level The message level.
+* @param[in]	file Source file of the log statement.
+* @param[in]	line Source line of the log statement.
+* @param[in]	func Function containing the log statement.
+* @param[in]	fmt printf-style format string.
+* @return	    None.
+*/
+void logger_write(int level, const char *file, int line, const char *func,
+        const char *fmt, ...)
+{
+    pthread_once(&init_once, init);
+    if (level < __atomic_load_n(&logger_level, __ATOMIC_RELAXED)) {
+        /* The first message is checked before LOGGER_LEVEL is read. */
+        return;
+    }
+
+    struct log_ring *ring = get_ring();
+    if (ring == NULL) {
+        return;
+    }
+
+    size_t head = ring->head;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == RING_SLOTS) {
+        if (!writer_running) {
+            drain();
+        } else {
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    struct log_record *rec = &ring->slots[head & (RING_SLOTS - 1)];
+    rec->level = level;
+    rec->file = file;
+    rec->line = line;
+    rec->func = func;
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(rec->msg, MSG_SZ, fmt, args);
+    va_end(args);
+    if (len >= MSG_SZ) {
+        rec->msg[MSG_SZ - 2] = '\n';
+    }
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    if (!writer_running) {
+        drain();
+    }
+}
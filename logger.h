@@ -2,16 +2,19 @@
  * @file
  *
  * Helps facilitate debugging by providing basic logging functionality. Unlike
- * printf-style debugging, the log messages can be enabled/disabled by changing 
+ * printf-style debugging, the log messages can be enabled/disabled by changing
  * the value of LOGGER.
+ *
+ * Messages are formatted by the calling thread into its own lock-free ring
+ * buffer and written out by a background thread, so logging from hot paths
+ * does not cost a syscall per message. Messages below LOGGER_MIN_LEVEL are
+ * removed at compile time; the remaining ones can be filtered at runtime with
+ * logger_set_level() or the LOGGER_LEVEL environment variable.
  */
 
 #ifndef _LOGGER_H_
 #define _LOGGER_H_
 
-#include <stdio.h>
-#include <unistd.h>
-
 /**
  * If LOGGER is not set, it will be enabled by default.
  */
@@ -34,51 +37,62 @@
 #endif
 
 /**
- * Prints an unformatted log message (single string).
+ * Log levels, in increasing order of severity.
+ */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE  4
+
+/**
+ * Messages below this level are compiled out entirely.
+ */
+#ifndef LOGGER_MIN_LEVEL
+#define LOGGER_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * Current runtime log level. Use logger_set_level() to change it.
+ */
+extern int logger_level;
+
+void logger_flush(void);
+int logger_parse_level(const char *name);
+void logger_set_level(int level);
+void logger_write(int level, const char *file, int line, const char *func,
+        const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+
+/**
+ * Prints a formatted log message at the given level.
  *
  * Example Usage:
- * LOGP("Hello world!");
+ * LOGL(LOG_LEVEL_WARN, "Could not open %s\n", path);
  */
-#define LOGP(str) \
+#define LOGL(level, ...) \
     do { \
-        if (LOGGER) { \
-            if (LOGGER_COLOR) { \
-                if (isatty(STDERR_FILENO)) { \
-                    fprintf(stderr, "%s%s%s:%d:%s%s()%s: %s", \
-                            LOGGER_COLOR_RED, __FILE__, LOGGER_COLOR_RESET, \
-                            __LINE__, \
-                            LOGGER_COLOR_BLUE, __func__, LOGGER_COLOR_RESET, \
-                            str); \
-                    break; \
-                } \
-                fprintf(stderr, "%s:%d:%s(): %s", \
-                        __FILE__, __LINE__, __func__, str); \
-            } \
+        if (LOGGER && (level) >= LOGGER_MIN_LEVEL \
+                && (level) >= __atomic_load_n(&logger_level, \
+                    __ATOMIC_RELAXED)) { \
+            logger_write((level), __FILE__, __LINE__, __func__, \
+                    __VA_ARGS__); \
         } \
     } while (0)
 
+/**
+ * Prints an unformatted log message (single string).
+ *
+ * Example Usage:
+ * LOGP("Hello world!");
+ */
+#define LOGP(str) LOGL(LOG_LEVEL_DEBUG, "%s", str)
+
 /**
  * Prints a formatted log message.
  *
  * Example Usage:
  * LOG("Hello %s, your lucky number is %d\n", "World", 42);
  */
-#define LOG(fmt, ...) \
-    do { \
-        if (LOGGER) { \
-            if (LOGGER_COLOR) { \
-                if (isatty(STDERR_FILENO)) { \
-                    fprintf(stderr, "%s%s%s:%d:%s%s()%s: " fmt, \
-                            LOGGER_COLOR_RED, __FILE__, LOGGER_COLOR_RESET, \
-                            __LINE__, \
-                            LOGGER_COLOR_BLUE, __func__, LOGGER_COLOR_RESET, \
-                            __VA_ARGS__); \
-                    break; \
-                } \
-                fprintf(stderr, "%s:%d:%s(): " fmt, __FILE__, \
-                        __LINE__, __func__, __VA_ARGS__); \
-            } \
-        } \
-    } while (0)
+#define LOG(...) LOGL(LOG_LEVEL_DEBUG, __VA_ARGS__)
 
 #endif
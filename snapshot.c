@@ -0,0 +1,535 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elist.h"
+#include "snapshot.h"
+#include "logger.h"
+#include "util.h"
+
+/**
+* Identifies a snapshot file and its format version. Version 2 follows it
+* with the scanned root (uint32 length and bytes) and stores every path
+* relative to that root.
+*/
+#define SNAPSHOT_MAGIC "DASNAP2\n"
+
+/**
+* stdio buffer size for snapshot files.
+*/
+#define SNAPSHOT_BUF_SZ (64 * 1024)
+
+/**
+* A stream of entries in path order, read either from a snapshot file or
+* from a scan sorted by path. Paths are relative to root, so snapshots of the
+* same directory compare equal however it was spelled.
+*/
+struct snapshot {
+    FILE *file;                 /*!< Snapshot file, or NULL */
+    struct extsort *sorter;     /*!< Path-sorted scan, or NULL */
+    char *root;                 /*!< Absolute path of the scanned directory */
+    size_t skip;                /*!< Prefix to drop from scanned paths */
+};
+
+/**
+* A file or directory whose size changed between two snapshots.
+*/
+struct change {
+    long long delta;    /*!< Ranking key: size change, or size */
+    char *path;
+};
+
+/**
+* The largest changes seen so far, kept as a min-heap of at most limit
+* entries so memory does not depend on the number of entries compared.
+*/
+struct top {
+    size_t limit;
+    struct elist *heap;     /*!< struct change, smallest delta first */
+};
+
+/**
+* Running size change of a directory whose entries are still being read.
+*/
+struct dir_total {
+    char *path;
+    size_t len;
+    long long delta;
+};
+
+/**
+* @brief		Open a snapshot file for reading.
+* @details	    Open a snapshot file for reading and check its header.
+* @param[in]	file Path of the snapshot file.
+* @return	    The snapshot, or NULL on error.
+*/
+struct snapshot *snapshot_open(const char *file)
+{
+    FILE *in = fopen(file, "r");
+    if (in == NULL) {
+        return NULL;
+    }
+    setvbuf(in, NULL, _IOFBF, SNAPSHOT_BUF_SZ);
+
+    char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+    uint32_t len;
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic)
+            || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0
+            || fread(&len, sizeof(len), 1, in) != 1 || len >= PATH_MAX) {
+        LOGL(LOG_LEVEL_ERROR, "Not a snapshot file: %s\n", file);
+        fclose(in);
+        return NULL;
+    }
+
+    struct snapshot *snap = calloc(1, sizeof(struct snapshot));
+    if (snap == NULL || (snap->root = malloc(len + 1)) == NULL
+            || fread(snap->root, 1, len, in) != len) {
+        LOGL(LOG_LEVEL_ERROR, "Could not read snapshot header: %s\n", file);
+        if (snap != NULL) {
+            free(snap->root);
+            free(snap);
+        }
+        fclose(in);
+        return NULL;
+    }
+    snap->root[len] = '\0';
+    snap->file = in;
+    return snap;
+}
+
+/**
+* @brief		Wrap a finished scan as a snapshot.
+* @details	    Wrap a scan that was sorted by path and finished as a snapshot.
+*               The snapshot takes ownership of the sorter, and records the
+*               directory by its absolute path.
+* @param[in]	sorter The path-sorted scan.
+* @param[in]	directory The directory as it was passed to traverse().
+* @return	    The snapshot, or NULL on error.
+*/
+struct snapshot *snapshot_from_sorter(struct extsort *sorter,
+        const char *directory)
+{
+    struct snapshot *snap = calloc(1, sizeof(struct snapshot));
+    if (snap == NULL) {
+        return NULL;
+    }
+    snap->root = realpath(directory, NULL);
+    if (snap->root == NULL) {
+        free(snap);
+        return NULL;
+    }
+    snap->sorter = sorter;
+    snap->skip = strlen(directory) + 1;
+    return snap;
+}
+
+/**
+* @brief		Join a snapshot's root and a relative path for display.
+* @details	    Join a snapshot's root and a path relative to it.
+* @param[out]	buf The buffer to write into.
+* @param[in]	size Size of buf.
+* @param[in]	root The snapshot's root.
+* @param[in]	path The relative path.
+* @return	    None.
+*/
+static void join_root(char *buf, size_t size, const char *root,
+        const char *path)
+{
+    size_t len = strlen(root);
+    snprintf(buf, size, "%s%s%s", root,
+            len > 0 && root[len - 1] == '/' ? "" : "/", path);
+}
+
+/**
+* @brief		Get the next entry in path order.
+* @details	    Get the next entry in path order. The caller owns the
+*               returned path.
+* @param[in]	snap The snapshot.
+* @param[out]	entry The next entry.
+* @return	    1 if an entry was returned, 0 when done, -1 on error.
+*/
+int snapshot_next(struct snapshot *snap, struct f *entry)
+{
+    if (snap->file != NULL) {
+        return extsort_read_entry(snap->file, entry);
+    }
+    int rc = extsort_next(snap->sorter, entry);
+    if (rc == 1) {
+        size_t len = strlen(entry->path);
+        size_t skip = snap->skip < len ? snap->skip : len;
+        memmove(entry->path, entry->path + skip, len - skip + 1);
+    }
+    return rc;
+}
+
+/**
+* @brief		Close a snapshot.
+* @details	    Close a snapshot and its file or scan.
+* @param[in]	snap The snapshot.
+* @return	    None.
+*/
+void snapshot_close(struct snapshot *snap)
+{
+    if (snap->file != NULL) {
+        fclose(snap->file);
+    }
+    if (snap->sorter != NULL) {
+        extsort_destroy(snap->sorter);
+    }
+    free(snap->root);
+    free(snap);
+}
+
+/**
+* @brief		Write the remaining entries of a snapshot to a file.
+* @details	    Write the remaining entries of a snapshot to a new snapshot
+*               file, keeping them in path order.
+* @param[in]	snap The snapshot to read from.
+* @param[in]	file Path of the file to write.
+* @return	    If success return 0, else return -1.
+*/
+int snapshot_save(struct snapshot *snap, const char *file)
+{
+    FILE *out = fopen(file, "w");
+    if (out == NULL) {
+        return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, SNAPSHOT_BUF_SZ);
+
+    uint32_t len = strlen(snap->root);
+    int rc = fwrite(SNAPSHOT_MAGIC, 1, sizeof(SNAPSHOT_MAGIC) - 1, out)
+        == sizeof(SNAPSHOT_MAGIC) - 1
+        && fwrite(&len, sizeof(len), 1, out) == 1
+        && fwrite(snap->root, 1, len, out) == len ? 1 : -1;
+    struct f entry;
+    while (rc == 1 && (rc = snapshot_next(snap, &entry)) == 1) {
+        rc = extsort_write_entry(out, &entry) == -1 ? -1 : 1;
+        free(entry.path);
+    }
+
+    if (fclose(out) != 0) {
+        rc = -1;
+    }
+    return rc == 0 ? 0 : -1;
+}
+
+/**
+* @brief		Swap two changes in a heap.
+* @details	    Swap two changes in a heap.
+* @param[in]	heap The heap.
+* @param[in]	a Index of the first change.
+* @param[in]	b Index of the second change.
+* @return	    None.
+*/
+static void swap_changes(struct elist *heap, size_t a, size_t b)
+{
+    struct change temp = *(struct change *) elist_get(heap, a);
+    elist_set(heap, a, elist_get(heap, b));
+    elist_set(heap, b, &temp);
+}
+
+/**
+* @brief		Offer a change to a top-N list.
+* @details	    Keep the change if it is among the limit largest seen so far.
+* @param[in]	top The top-N list.
+* @param[in]	delta The ranking key.
+* @param[in]	path The path that changed (copied if kept).
+* @return	    If success return 0, else return -1.
+*/
+static int top_offer(struct top *top, long long delta, const char *path)
+{
+    struct elist *heap = top->heap;
+    size_t size = elist_size(heap);
+    if (top->limit == 0) {
+        return 0;
+    }
+
+    if (size < top->limit) {
+        struct change change = { delta, strdup(path) };
+        if (change.path == NULL || elist_add(heap, &change) == -1) {
+            free(change.path);
+            return -1;
+        }
+        for (size_t i = size; i > 0; i = (i - 1) / 2) {
+            struct change *child = elist_get(heap, i);
+            struct change *parent = elist_get(heap, (i - 1) / 2);
+            if (parent->delta <= child->delta) {
+                break;
+            }
+            swap_changes(heap, i, (i - 1) / 2);
+        }
+        return 0;
+    }
+
+    struct change *root = elist_get(heap, 0);
+    if (delta <= root->delta) {
+        return 0;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return -1;
+    }
+    free(root->path);
+    root->delta = delta;
+    root->path = copy;
+
+    size_t i = 0;
+    while (true) {
+        size_t least = i;
+        for (size_t c = 2 * i + 1; c <= 2 * i + 2 && c < size; c++) {
+            if (((struct change *) elist_get(heap, c))->delta
+                    < ((struct change *) elist_get(heap, least))->delta) {
+                least = c;
+            }
+        }
+        if (least == i) {
+            break;
+        }
+        swap_changes(heap, i, least);
+        i = least;
+    }
+    return 0;
+}
+
+/**
+* @brief		The comparator function to sort changes, largest first.
+* @details	    The comparator function to sort changes, largest first.
+* @param[in]	a First argument.
+* @param[in]    b Second argument.
+* @return       If b is larger, return 1, if equal, return 0, else return -1.
+*/
+static int cmp_change(const void *a, const void *b)
+{
+    const struct change *ca = a;
+    const struct change *cb = b;
+    if (ca->delta != cb->delta) {
+        return ca->delta < cb->delta ? 1 : -1;
+    }
+    return strcmp(ca->path, cb->path);
+}
+
+/**
+* @brief		Print and free a top-N list.
+* @details	    Print a top-N list under a heading, largest first, and free its
+*               entries.
+* @param[in]	title The heading.
+* @param[in]	sign Sign to show in front of each size.
+* @param[in]	root Root the listed paths are relative to.
+* @param[in]	top The top-N list.
+* @return	    None.
+*/
+static void top_print(const char *title, char sign, const char *root,
+        struct top *top)
+{
+    printf("%s:\n", title);
+    elist_sort(top->heap, cmp_change);
+    for (size_t i = 0; i < elist_size(top->heap); i++) {
+        struct change *change = elist_get(top->heap, i);
+        char size[15];
+        char path[PATH_MAX];
+        human_readable_size(size, sizeof(size), (double) change->delta, 1);
+        join_root(path, sizeof(path), root, change->path);
+        printf("%c%s  %s\n", sign, size, path);
+        free(change->path);
+    }
+    printf("\n");
+    elist_destroy(top->heap);
+}
+
+/**
+* @brief		Finish the innermost open directory.
+* @details	    Rank the innermost open directory by its size change and add
+*               that change to its parent.
+* @param[in]	stack The open directories, outermost first.
+* @param[in]	dirs Top-N list of directories.
+* @return	    If success return 0, else return -1.
+*/
+static int dir_pop(struct elist *stack, struct top *dirs)
+{
+    int rc = 0;
+    size_t last = elist_size(stack) - 1;
+    struct dir_total *dir = elist_get(stack, last);
+    if (dir->delta > 0) {
+        rc = top_offer(dirs, dir->delta, dir->path);
+    }
+    if (last > 0) {
+        ((struct dir_total *) elist_get(stack, last - 1))->delta += dir->delta;
+    }
+    free(dir->path);
+    elist_remove(stack, last);
+    return rc;
+}
+
+/**
+* @brief		Add a file's size change to its directories.
+* @details	    Add a file's size change to its directories below the root.
+*               Entries arrive in path order, so every file under a directory
+*               arrives in one contiguous stretch; directories are finished as
+*               soon as the path leaves them, keeping only the current
+*               ancestors open. The root's own change is the diff's total.
+* @param[in]	stack The open directories, outermost first.
+* @param[in]	dirs Top-N list of directories.
+* @param[in]	path The file path, relative to the root.
+* @param[in]	delta The file's size change.
+* @return	    If success return 0, else return -1.
+*/
+static int dir_account(struct elist *stack, struct top *dirs,
+        const char *path, long long delta)
+{
+    int rc = 0;
+    struct dir_total *top = NULL;
+    while (elist_size(stack) > 0) {
+        top = elist_get(stack, elist_size(stack) - 1);
+        if (strncmp(path, top->path, top->len) == 0
+                && path[top->len] == '/') {
+            break;
+        }
+        if (dir_pop(stack, dirs) == -1) {
+            rc = -1;
+        }
+        top = NULL;
+    }
+
+    const char *slash = strchr(path + (top != NULL ? top->len + 1 : 0), '/');
+    for (; slash != NULL; slash = strchr(slash + 1, '/')) {
+        size_t len = slash - path;
+        struct dir_total dir = { strndup(path, len), len, 0 };
+        if (dir.path == NULL || elist_add(stack, &dir) == -1) {
+            /* Charge the change to the deepest directory that was opened. */
+            free(dir.path);
+            rc = -1;
+            break;
+        }
+    }
+
+    if (elist_size(stack) > 0) {
+        top = elist_get(stack, elist_size(stack) - 1);
+        top->delta += delta;
+    }
+    return rc;
+}
+
+/**
+* @brief		Read the next entry and check that it is in path order.
+* @details	    Replace cur with the next entry, freeing the old path.
+* @param[in]	snap The snapshot.
+* @param[in,out] cur The current entry; path is NULL before the first read.
+* @return	    1 if an entry was read, 0 when done, -1 on error.
+*/
+static int advance(struct snapshot *snap, struct f *cur)
+{
+    struct f next;
+    int rc = snapshot_next(snap, &next);
+    if (rc == 1 && cur->path != NULL && strcmp(cur->path, next.path) >= 0) {
+        LOGL(LOG_LEVEL_ERROR, "Snapshot is not sorted by path at %s\n",
+                next.path);
+        free(next.path);
+        rc = -1;
+    }
+    free(cur->path);
+    cur->path = NULL;
+    if (rc == 1) {
+        *cur = next;
+    }
+    return rc;
+}
+
+/**
+* @brief		Report what changed between two snapshots.
+* @details	    Join two path-ordered snapshots in one linear pass and print
+*               the files and directories that grew most and the largest
+*               new and deleted files. Memory use depends only on limit and
+*               directory depth, not on the number of entries. Paths are
+*               matched relative to each snapshot's root, with a warning if
+*               the roots differ.
+* @param[in]	old The earlier snapshot.
+* @param[in]	new The later snapshot.
+* @param[in]	limit Number of entries to show in each list.
+* @return	    If success return 0, else return -1.
+*/
+int snapshot_diff(struct snapshot *old, struct snapshot *new,
+        unsigned int limit)
+{
+    struct top grew = { limit, elist_create(limit, sizeof(struct change)) };
+    struct top dirs = { limit, elist_create(limit, sizeof(struct change)) };
+    struct top added = { limit, elist_create(limit, sizeof(struct change)) };
+    struct top deleted = { limit, elist_create(limit, sizeof(struct change)) };
+    struct elist *stack = elist_create(0, sizeof(struct dir_total));
+    unsigned long long old_total = 0, new_total = 0;
+    size_t added_count = 0, deleted_count = 0;
+    bool failed = false;
+
+    struct elist *lists[] = { grew.heap, dirs.heap, added.heap, deleted.heap,
+        stack };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        failed |= lists[i] == NULL;
+    }
+    if (failed) {
+        for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+            if (lists[i] != NULL) {
+                elist_destroy(lists[i]);
+            }
+        }
+        return -1;
+    }
+
+    if (strcmp(old->root, new->root) != 0) {
+        fprintf(stderr, "Warning: comparing %s with %s; paths are matched "
+                "relative to each.\n", old->root, new->root);
+    }
+
+    struct f o = { 0 }, n = { 0 };
+    int old_rc = advance(old, &o);
+    int new_rc = advance(new, &n);
+    while (old_rc == 1 || new_rc == 1) {
+        int c = old_rc != 1 ? 1 : new_rc != 1 ? -1 : strcmp(o.path, n.path);
+        if (c < 0) {
+            old_total += o.size;
+            deleted_count++;
+            failed |= top_offer(&deleted, o.size, o.path) == -1;
+            failed |= dir_account(stack, &dirs, o.path,
+                    -(long long) o.size) == -1;
+            old_rc = advance(old, &o);
+        } else if (c > 0) {
+            new_total += n.size;
+            added_count++;
+            failed |= top_offer(&added, n.size, n.path) == -1;
+            failed |= dir_account(stack, &dirs, n.path, n.size) == -1;
+            new_rc = advance(new, &n);
+        } else {
+            long long delta = (long long) n.size - (long long) o.size;
+            old_total += o.size;
+            new_total += n.size;
+            if (delta > 0) {
+                failed |= top_offer(&grew, delta, n.path) == -1;
+            }
+            failed |= dir_account(stack, &dirs, n.path, delta) == -1;
+            old_rc = advance(old, &o);
+            new_rc = advance(new, &n);
+        }
+        if (old_rc == -1 || new_rc == -1 || failed) {
+            break;
+        }
+    }
+    while (elist_size(stack) > 0) {
+        failed |= dir_pop(stack, &dirs) == -1;
+    }
+    elist_destroy(stack);
+    free(o.path);
+    free(n.path);
+
+    char old_sz[15], new_sz[15];
+    human_readable_size(old_sz, sizeof(old_sz), (double) old_total, 1);
+    human_readable_size(new_sz, sizeof(new_sz), (double) new_total, 1);
+    printf("Total:%s ->%s, %zu new files, %zu deleted files\n\n",
+            old_sz, new_sz, added_count, deleted_count);
+    top_print("Files that grew most", '+', new->root, &grew);
+    top_print("Directories that grew most", '+', new->root, &dirs);
+    top_print("Largest new files", '+', new->root, &added);
+    top_print("Largest deleted files", '-', old->root, &deleted);
+
+    return old_rc == -1 || new_rc == -1 || failed ? -1 : 0;
+}
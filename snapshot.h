@@ -0,0 +1,18 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "extsort.h"
+#include "traverse.h"
+
+struct snapshot;
+
+void snapshot_close(struct snapshot *snap);
+int snapshot_diff(struct snapshot *old, struct snapshot *new,
+        unsigned int limit);
+struct snapshot *snapshot_from_sorter(struct extsort *sorter,
+        const char *directory);
+int snapshot_next(struct snapshot *snap, struct f *entry);
+struct snapshot *snapshot_open(const char *file);
+int snapshot_save(struct snapshot *snap, const char *file);
+
+#endif
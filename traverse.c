@@ -0,0 +1,602 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "elist.h"
+#include "traverse.h"
+#include "logger.h"
+
+/**
+* Initial number of slots in a visited-directory table. Must be a power of 2.
+*/
+#define VISITED_INIT_SZ 1024
+
+/**
+* Number of entries a worker collects before handing them to the sink, unless
+* traverse_options.batch says otherwise.
+*/
+#define EMIT_BATCH_SZ 4096
+
+/**
+* How deep a worker nests scanning subdirectories in place once the queue is
+* over traverse_options.queue_mem. Each level holds an open directory.
+*/
+#define INLINE_DEPTH_MAX 16
+
+/**
+* A directory identity: the same (dev, ino) pair reached twice is a cycle or a
+* mount of something we have already scanned. Only directories that can close
+* a cycle are recorded: the root, mount roots and followed symbolic links.
+*/
+struct dir_id {
+    dev_t dev;
+    ino_t ino;
+    bool used;
+};
+
+/**
+* Open-addressed hash set of visited directories.
+*/
+struct visited {
+    size_t capacity;
+    size_t size;
+    struct dir_id *slots;
+};
+
+struct scan;
+
+/**
+* A set of worker threads dedicated to a single device, so a slow device only
+* holds up its own directories.
+*/
+struct dev_pool {
+    dev_t dev;                  /*!< Device this pool scans */
+    pthread_mutex_t lock;       /*!< Protects queue and visited */
+    pthread_cond_t work_cond;   /*!< Signalled when work is queued or done */
+    struct elist *queue;        /*!< Directory paths (char *) to scan */
+    struct visited visited;     /*!< Cycle-prone directories already seen */
+    unsigned int nthreads;      /*!< Number of worker threads */
+    pthread_t *threads;         /*!< The worker threads */
+    struct scan *scan;          /*!< The scan this pool belongs to */
+};
+
+/**
+* State shared by every pool in one traversal.
+*/
+struct scan {
+    struct traverse_options *opts;
+    traverse_sink emit;         /*!< Receives every file found */
+    void *emit_arg;             /*!< Passed through to emit */
+    pthread_mutex_t emit_lock;  /*!< Serializes calls to emit */
+    bool failed;                /*!< emit reported an error, or part of the
+                                     tree could not be scanned */
+    dev_t root_dev;             /*!< Device of the starting directory */
+    pthread_mutex_t lock;       /*!< Protects pools and done */
+    pthread_cond_t done_cond;   /*!< Signalled when pending reaches zero */
+    struct elist *pools;        /*!< All pools (struct dev_pool *) */
+    size_t pending;             /*!< Directories queued but not finished */
+    size_t queued_bytes;        /*!< Estimated memory of queued paths */
+    bool done;                  /*!< No work left anywhere */
+};
+
+/**
+* Arguments handed to each worker thread.
+*/
+struct worker_arg {
+    struct dev_pool *pool;
+    struct flist *results;
+};
+
+/**
+* @brief		Hash a directory identity.
+* @details	    Hash a directory identity into a visited-table index.
+* @param[in]	dev The device number.
+* @param[in]	ino The inode number.
+* @param[in]	capacity Table capacity (a power of 2).
+* @return	    The starting slot index.
+*/
+static size_t dir_hash(dev_t dev, ino_t ino, size_t capacity)
+{
+    unsigned long long h = (unsigned long long) ino * 0x9E3779B97F4A7C15ULL;
+    h ^= (unsigned long long) dev + (h >> 29);
+    return (size_t) h & (capacity - 1);
+}
+
+/**
+* @brief		Mark a directory as visited.
+* @details	    Mark a directory as visited, growing the table when it gets
+*               more than half full.
+* @param[in]	set The visited set.
+* @param[in]	dev The device number.
+* @param[in]	ino The inode number.
+* @return	    1 if it was already visited, 0 if newly added, -1 on error.
+*/
+static int visited_add(struct visited *set, dev_t dev, ino_t ino)
+{
+    if ((set->size + 1) * 2 > set->capacity) {
+        size_t capacity = set->capacity == 0 ? VISITED_INIT_SZ
+            : set->capacity * 2;
+        struct dir_id *slots = calloc(capacity, sizeof(struct dir_id));
+        if (slots == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (set->slots[i].used) {
+                size_t j = dir_hash(set->slots[i].dev, set->slots[i].ino,
+                        capacity);
+                while (slots[j].used) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j] = set->slots[i];
+            }
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity = capacity;
+    }
+
+    size_t i = dir_hash(dev, ino, set->capacity);
+    while (set->slots[i].used) {
+        if (set->slots[i].dev == dev && set->slots[i].ino == ino) {
+            return 1;
+        }
+        i = (i + 1) & (set->capacity - 1);
+    }
+    set->slots[i].dev = dev;
+    set->slots[i].ino = ino;
+    set->slots[i].used = true;
+    set->size++;
+    return 0;
+}
+
+static void *worker_main(void *arg);
+
+/**
+* @brief		Get the number of entries a worker collects per batch.
+* @details	    Get the number of entries a worker collects before handing
+*               them to the sink.
+* @param[in]	scan The scan.
+* @return	    The batch size.
+*/
+static size_t batch_size(struct scan *scan)
+{
+    return scan->opts->batch == 0 ? EMIT_BATCH_SZ : scan->opts->batch;
+}
+
+/**
+* @brief		Free a pool.
+* @details	    Free a pool whose worker threads have exited or never started.
+* @param[in]	pool The pool.
+* @return	    None.
+*/
+static void destroy_pool(struct dev_pool *pool)
+{
+    if (pool->queue != NULL) {
+        elist_destroy(pool->queue);
+    }
+    free(pool->visited.slots);
+    free(pool->threads);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/**
+* @brief		Find or start the pool for a device.
+* @details	    Find the pool for a device, creating it and starting its
+*               worker threads the first time the device is seen. A pool runs
+*               with however many of its threads could be started; if none
+*               could, it is discarded.
+* @param[in]	scan The scan.
+* @param[in]	dev The device number.
+* @return	    The pool, or NULL on error.
+*/
+static struct dev_pool *get_pool(struct scan *scan, dev_t dev)
+{
+    pthread_mutex_lock(&scan->lock);
+    for (size_t i = 0; i < elist_size(scan->pools); i++) {
+        struct dev_pool *pool = *(struct dev_pool **) elist_get(scan->pools, i);
+        if (pool->dev == dev) {
+            pthread_mutex_unlock(&scan->lock);
+            return pool;
+        }
+    }
+
+    struct dev_pool *pool = calloc(1, sizeof(struct dev_pool));
+    if (pool == NULL) {
+        pthread_mutex_unlock(&scan->lock);
+        return NULL;
+    }
+    pool->dev = dev;
+    pool->scan = scan;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pool->queue = elist_create(0, sizeof(char *));
+    unsigned int jobs = scan->opts->jobs == 0 ? 1 : scan->opts->jobs;
+    pool->threads = calloc(jobs, sizeof(pthread_t));
+    if (pool->queue == NULL || pool->threads == NULL
+            || elist_add(scan->pools, &pool) == -1) {
+        destroy_pool(pool);
+        pthread_mutex_unlock(&scan->lock);
+        return NULL;
+    }
+
+    /* nthreads only counts threads that actually started, so the pool is
+     * never joined on a thread that does not exist. */
+    for (unsigned int i = 0; i < jobs; i++) {
+        struct worker_arg *warg = malloc(sizeof(struct worker_arg));
+        if (warg == NULL) {
+            break;
+        }
+        warg->pool = pool;
+        warg->results = flist_create(batch_size(scan));
+        if (warg->results == NULL) {
+            free(warg);
+            break;
+        }
+        if (pthread_create(&pool->threads[pool->nthreads], NULL,
+                    worker_main, warg) != 0) {
+            flist_destroy(warg->results);
+            free(warg);
+            break;
+        }
+        pool->nthreads++;
+    }
+    LOG("Started %u of %u worker(s) for device %lu\n",
+            pool->nthreads, jobs, (unsigned long) dev);
+
+    if (pool->nthreads == 0) {
+        elist_remove(scan->pools, elist_size(scan->pools) - 1);
+        destroy_pool(pool);
+        pool = NULL;
+    }
+    pthread_mutex_unlock(&scan->lock);
+
+    return pool;
+}
+
+/**
+* @brief		Estimate the memory a queued path holds.
+* @details	    Estimate the memory a queued path holds: the string with its
+*               malloc overhead, plus its slot in the queue.
+* @param[in]	path The directory path.
+* @return       The estimated number of bytes.
+*/
+static size_t queue_cost(const char *path)
+{
+    return ((strlen(path) + 1 + sizeof(size_t) + 15) & ~(size_t) 15)
+        + sizeof(char *);
+}
+
+/**
+* @brief		Queue a directory on its device's pool.
+* @details	    Queue a directory on its device's pool unless it has already
+*               been visited. Only directories that can close a cycle are
+*               checked against and added to the visited set. Takes ownership
+*               of path unless it returns 1.
+* @param[in]	scan The scan.
+* @param[in]	path The directory path (heap allocated).
+* @param[in]    info The directory's stat information.
+* @param[in]    record Whether the directory can close a cycle.
+* @param[in]    can_inline Whether the caller can scan it in place.
+* @return       0 if queued or already visited, 1 if the queue is over its
+*               budget and the caller should scan it in place, -1 if it could
+*               not be queued.
+*/
+static int dispatch(struct scan *scan, char *path, struct stat *info,
+        bool record, bool can_inline)
+{
+    if (path == NULL) {
+        return -1;
+    }
+
+    struct dev_pool *pool = get_pool(scan, info->st_dev);
+    if (pool == NULL) {
+        LOGL(LOG_LEVEL_ERROR, "No worker for device %lu, skipping: %s\n",
+                (unsigned long) info->st_dev, path);
+        free(path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    int visited = record
+        ? visited_add(&pool->visited, info->st_dev, info->st_ino) : 0;
+    if (visited != 0) {
+        pthread_mutex_unlock(&pool->lock);
+        if (visited == 1) {
+            LOG("Skipping already visited directory: %s\n", path);
+        } else {
+            LOGL(LOG_LEVEL_ERROR, "Out of memory, skipping: %s\n", path);
+        }
+        free(path);
+        return visited == 1 ? 0 : -1;
+    }
+    size_t cost = queue_cost(path);
+    size_t limit = scan->opts->queue_mem;
+    if (can_inline && limit != 0 && __atomic_load_n(&scan->queued_bytes,
+                __ATOMIC_RELAXED) + cost > limit) {
+        pthread_mutex_unlock(&pool->lock);
+        return 1;
+    }
+    if (elist_add(pool->queue, &path) == -1) {
+        pthread_mutex_unlock(&pool->lock);
+        free(path);
+        return -1;
+    }
+    __atomic_add_fetch(&scan->queued_bytes, cost, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&scan->pending, 1, __ATOMIC_ACQ_REL);
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/**
+* @brief		Record that the scan is incomplete.
+* @details	    Record that the scan is incomplete, so traverse() reports an
+*               error instead of passing off a partial tree as the whole.
+* @param[in]	scan The scan.
+* @return       None.
+*/
+static void fail(struct scan *scan)
+{
+    __atomic_store_n(&scan->failed, true, __ATOMIC_RELEASE);
+}
+
+/**
+* @brief		End the scan.
+* @details	    Mark the scan as done and wake every pool so its workers can
+*               exit, and the caller of traverse() so it can join them.
+* @param[in]	scan The scan.
+* @return       None.
+*/
+static void stop(struct scan *scan)
+{
+    pthread_mutex_lock(&scan->lock);
+    __atomic_store_n(&scan->done, true, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < elist_size(scan->pools); i++) {
+        struct dev_pool *pool = *(struct dev_pool **) elist_get(scan->pools, i);
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->work_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pthread_cond_broadcast(&scan->done_cond);
+    pthread_mutex_unlock(&scan->lock);
+}
+
+/**
+* @brief		Mark one queued directory as finished.
+* @details	    Mark one queued directory as finished. The last one to finish
+*               ends the scan.
+* @param[in]	scan The scan.
+* @return       None.
+*/
+static void finish(struct scan *scan)
+{
+    if (__atomic_sub_fetch(&scan->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        stop(scan);
+    }
+}
+
+/**
+* @brief		Hand a worker's collected entries to the sink.
+* @details	    Hand a worker's collected entries to the sink and empty the
+*               worker's list. Ownership of each path moves to the sink,
+*               unless the sink has failed.
+* @param[in]	scan The scan.
+* @param[in]	list The worker's list of struct f.
+* @return       None.
+*/
+static void flush_results(struct scan *scan, struct flist *list)
+{
+    pthread_mutex_lock(&scan->emit_lock);
+    for (size_t i = 0; i < flist_size(list); i++) {
+        /* Once the sink fails, the rest of the scan's entries are dropped
+         * rather than offered to it again. */
+        if (__atomic_load_n(&scan->failed, __ATOMIC_ACQUIRE)
+                || scan->emit(&list->items[i], scan->emit_arg) == -1) {
+            fail(scan);
+            free(list->items[i].path);
+        }
+    }
+    pthread_mutex_unlock(&scan->emit_lock);
+    flist_clear(list);
+}
+
+/**
+* @brief		To traverse a path and write into a elist.
+* @details	    Read one directory, adding its files to list and queueing its
+*               subdirectories according to the scan options. While the
+*               queue is over its budget, subdirectories are scanned in place
+*               instead, up to INLINE_DEPTH_MAX levels deep.
+* @param[in]	scan The scan.
+* @param[in]	list The elist we want to write into.
+* @param[in]    path The path we want to traverse.
+* @param[in]    depth How many levels this call is nested in place.
+* @return       None.
+*/
+static void tDir(struct scan *scan, struct flist *list, char *path,
+        unsigned int depth)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        LOGL(LOG_LEVEL_WARN, "Could not open directory: %s\n", path);
+        return;
+    }
+
+    /* A subdirectory on another device is a mount root, which may mount
+     * something already scanned. */
+    struct stat self;
+    dev_t dir_dev = fstat(dirfd(dir), &self) == 0 ? self.st_dev : (dev_t) -1;
+
+    int follow = scan->opts->symlinks == SYMLINKS_ALWAYS
+        ? 0 : AT_SYMLINK_NOFOLLOW;
+    struct dirent *currentDir = NULL;
+    char p[PATH_MAX];
+
+    while ((currentDir = readdir(dir)) != NULL) {
+        if (!strcmp(currentDir->d_name, ".")
+                || !strcmp(currentDir->d_name, "..")) {
+            continue;
+        }
+        snprintf(p, sizeof(p), "%s/%s", path, currentDir->d_name);
+
+        struct stat info;
+        if (fstatat(dirfd(dir), currentDir->d_name, &info, follow) == -1
+                && (follow != 0 || fstatat(dirfd(dir), currentDir->d_name,
+                        &info, AT_SYMLINK_NOFOLLOW) == -1)) {
+            LOGL(LOG_LEVEL_WARN, "Could not stat: %s\n", p);
+            continue;
+        }
+
+        if (S_ISDIR(info.st_mode)) {
+            if (scan->opts->one_file_system && info.st_dev != scan->root_dev) {
+                LOG("Not crossing into other file system: %s\n", p);
+                continue;
+            }
+            bool linked = false;
+            if (follow == 0 && currentDir->d_type == DT_LNK) {
+                linked = true;
+            } else if (follow == 0 && currentDir->d_type == DT_UNKNOWN) {
+                struct stat link;
+                linked = fstatat(dirfd(dir), currentDir->d_name, &link,
+                        AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(link.st_mode);
+            }
+
+            char *sub = strdup(p);
+            int rc = dispatch(scan, sub, &info,
+                    linked || info.st_dev != dir_dev, depth < INLINE_DEPTH_MAX);
+            if (rc == -1) {
+                fail(scan);
+            } else if (rc == 1) {
+                tDir(scan, list, sub, depth + 1);
+                free(sub);
+            }
+        } else {
+            struct f temp = { info.st_size, strdup(p),
+                info.st_atimespec.tv_sec };
+            if (temp.path == NULL || flist_add(list, &temp) == -1) {
+                LOGL(LOG_LEVEL_ERROR, "Out of memory, skipping: %s\n", p);
+                free(temp.path);
+                fail(scan);
+                continue;
+            }
+            if (flist_size(list) >= batch_size(scan)) {
+                flush_results(scan, list);
+            }
+        }
+    }
+    closedir(dir);
+}
+
+/**
+* @brief		Worker thread body.
+* @details	    Pull directories off the pool's queue until the whole scan
+*               has no work left.
+* @param[in]	arg The worker_arg for this thread.
+* @return       NULL.
+*/
+static void *worker_main(void *arg)
+{
+    struct worker_arg *warg = arg;
+    struct dev_pool *pool = warg->pool;
+    struct scan *scan = pool->scan;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        while (elist_size(pool->queue) == 0
+                && !__atomic_load_n(&scan->done, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (elist_size(pool->queue) == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        size_t last = elist_size(pool->queue) - 1;
+        char *path = *(char **) elist_get(pool->queue, last);
+        elist_remove(pool->queue, last);
+        pthread_mutex_unlock(&pool->lock);
+
+        __atomic_sub_fetch(&scan->queued_bytes, queue_cost(path),
+                __ATOMIC_RELAXED);
+        tDir(scan, warg->results, path, 0);
+        free(path);
+        finish(scan);
+    }
+
+    flush_results(scan, warg->results);
+    flist_destroy(warg->results);
+    free(warg);
+    return NULL;
+}
+
+/**
+* @brief		Traverse a directory tree and pass each file to a sink.
+* @details	    Traverse a directory tree and pass each file to a sink.
+*               Each device gets its own pool of worker threads, the root,
+*               mount roots and followed links are visited at most once (by
+*               device and inode) so cycles end, and mount points and
+*               symbolic links are crossed according to opts.
+*               Calls to emit are serialized, and emit takes ownership of
+*               each entry's path.
+* @param[in]    path The directory to start from.
+* @param[in]    opts Traversal options.
+* @param[in]	emit Called once for every file found.
+* @param[in]	arg Passed through to emit.
+* @return       If success return 0, else return -1.
+*/
+int traverse(char *path, struct traverse_options *opts, traverse_sink emit,
+        void *arg)
+{
+    struct stat info;
+    int rc = opts->symlinks == SYMLINKS_NEVER
+        ? lstat(path, &info) : stat(path, &info);
+    if (rc == -1 || !S_ISDIR(info.st_mode)) {
+        return -1;
+    }
+
+    struct scan scan = { 0 };
+    scan.opts = opts;
+    scan.root_dev = info.st_dev;
+    scan.emit = emit;
+    scan.emit_arg = arg;
+    scan.pools = elist_create(0, sizeof(struct dev_pool *));
+    if (scan.pools == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&scan.emit_lock, NULL);
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.done_cond, NULL);
+
+    /* If the root cannot be queued nothing will ever call finish(), so end
+     * the scan here; its pool may already have workers waiting for work. */
+    if (dispatch(&scan, strdup(path), &info, true, false) == -1) {
+        fail(&scan);
+        stop(&scan);
+    }
+
+    pthread_mutex_lock(&scan.lock);
+    while (!scan.done) {
+        pthread_cond_wait(&scan.done_cond, &scan.lock);
+    }
+    pthread_mutex_unlock(&scan.lock);
+
+    for (size_t i = 0; i < elist_size(scan.pools); i++) {
+        struct dev_pool *pool = *(struct dev_pool **) elist_get(scan.pools, i);
+        for (unsigned int j = 0; j < pool->nthreads; j++) {
+            pthread_join(pool->threads[j], NULL);
+        }
+        destroy_pool(pool);
+    }
+    elist_destroy(scan.pools);
+    pthread_cond_destroy(&scan.done_cond);
+    pthread_mutex_destroy(&scan.lock);
+    pthread_mutex_destroy(&scan.emit_lock);
+
+    return scan.failed ? -1 : 0;
+}
@@ -0,0 +1,100 @@
+#ifndef _TRAVERSE_H_
+#define _TRAVERSE_H_
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "elist_typed.h"
+
+/**
+* The struct of the element in elist about documents.
+*/
+struct f{
+    unsigned long size;
+    char* path;
+    time_t accTime;
+};
+
+/**
+* Typed elist of struct f, used where entries are collected in bulk.
+*/
+ELIST_DEFINE(flist, struct f)
+
+/**
+* @brief		The comparator function to sort with last accessed time.
+* @details	    The comparator function to sort with last accessed time, most
+*               recent first, ties broken by path.
+* @param[in]	sa First argument.
+* @param[in]    sb Second argument.
+* @return       If b is after a, return 1, if b and a is equivalent, return 0, else return -1.
+*/
+static inline int cmp_time(const struct f *sa, const struct f *sb) {
+    if (sa->accTime != sb->accTime) {
+        return sa->accTime < sb->accTime ? 1 : -1;
+    }
+    return strcmp(sa->path, sb->path);
+}
+
+/**
+* @brief		The comparator function to sort with size.
+* @details	    The comparator function to sort with size, largest first, ties
+*               broken by path.
+* @param[in]	sa First argument.
+* @param[in]    sb Second argument.
+* @return       If b is larger than a, return 1, if b and a is equivalent, return 0, else return -1.
+*/
+static inline int cmp_size(const struct f *sa, const struct f *sb) {
+    if (sa->size != sb->size) {
+        return sa->size < sb->size ? 1 : -1;
+    }
+    return strcmp(sa->path, sb->path);
+}
+
+/**
+* @brief		The comparator function to sort by path.
+* @details	    The comparator function to sort by path, the order snapshots
+*               are stored in.
+* @param[in]	sa First argument.
+* @param[in]    sb Second argument.
+* @return       The strcmp() of the two paths.
+*/
+static inline int cmp_path(const struct f *sa, const struct f *sb) {
+    return strcmp(sa->path, sb->path);
+}
+
+/**
+* How symbolic links are treated during traversal.
+*/
+enum symlink_policy {
+    SYMLINKS_NEVER,         /*!< Never follow; links are listed as files (-P) */
+    SYMLINKS_ROOT,          /*!< Follow only the starting directory (-H,
+                                 default) */
+    SYMLINKS_ALWAYS,        /*!< Follow every link (-L) */
+};
+
+/**
+* Options that control how a directory tree is traversed.
+*/
+struct traverse_options {
+    bool one_file_system;           /*!< Stay on the starting device (-x) */
+    enum symlink_policy symlinks;   /*!< Symbolic link handling */
+    unsigned int jobs;              /*!< Worker threads per device */
+    unsigned int batch;             /*!< Entries a worker holds before handing
+                                         them to the sink, 0 for the default */
+    size_t queue_mem;               /*!< Bytes of queued directory paths
+                                         before workers scan subdirectories
+                                         in place, 0 for no limit */
+};
+
+/**
+* Receives each file found by traverse() and takes ownership of its path.
+* Returns 0, or -1 on error, after which traverse() frees the path itself and
+* stops passing files on.
+*/
+typedef int (*traverse_sink)(struct f *entry, void *arg);
+
+int traverse(char *path, struct traverse_options *opts, traverse_sink emit,
+        void *arg);
+
+#endif
@@ -1,6 +1,8 @@
 #include "util.h"
 
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <tgmath.h>
@@ -50,6 +52,41 @@ void human_readable_size(char *buf, size_t buf_sz, double size, unsigned int dec
     }
 }
 
+/**
+* @brief		Parse a byte count such as "512M".
+* @details	    Parse a byte count with an optional K, M, G or T suffix
+*               (powers of 1024, case ignored).
+* @param[in]	str The string to parse.
+* @param[out]	size The number of bytes.
+* @return	    If success return 0, else return -1.
+*/
+int parse_size(const char *str, size_t *size)
+{
+    char *endptr;
+    unsigned long long value = strtoull(str, &endptr, 10);
+    if (endptr == str || *str == '-') {
+        return -1;
+    }
+
+    int shift = 0;
+    switch (*endptr) {
+        case 'k': case 'K': shift = 10; break;
+        case 'm': case 'M': shift = 20; break;
+        case 'g': case 'G': shift = 30; break;
+        case 't': case 'T': shift = 40; break;
+        case '\0': break;
+        default: return -1;
+    }
+    if (shift != 0 && *(endptr + 1) != '\0') {
+        return -1;
+    }
+    if (value > (SIZE_MAX >> shift)) {
+        return -1;
+    }
+    *size = (size_t) value << shift;
+    return 0;
+}
+
 size_t simple_time_format(char *buf, size_t buf_sz, time_t time)
 {
     struct tm *tmtime = localtime(&time);
@@ -4,6 +4,7 @@
 #include <sys/types.h>
 
 void human_readable_size(char *buf, size_t buf_sz, double size, unsigned int decimals);
+int parse_size(const char *str, size_t *size);
 size_t simple_time_format(char *buf, size_t buf_sz, time_t time);
 
 #endif